@@ -2,8 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
-#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "ai.h"
+#include "profile.h"
+#ifdef SEARCH_TRACE
+#include "searchtrace.h"
+#endif
 
 // Piece-Square Tables (adapted from chess programming wiki)
 // Values are for white pieces. For black pieces, the tables are flipped.
@@ -92,187 +97,1048 @@ const int KING_TABLE_END[64] = {
     -50,-30,-30,-30,-30,-30,-30,-50
 };
 
-// Piece values (centipawns)
-#define PAWN_VALUE 100
-#define KNIGHT_VALUE 320
-#define BISHOP_VALUE 330
-#define ROOK_VALUE 500
-#define QUEEN_VALUE 900
-#define KING_VALUE 20000
+// Piece values indexed by piece type, for exchange and capture ordering
+static const int pieceValues[7] = {
+    0, PAWN_VALUE, KNIGHT_VALUE, BISHOP_VALUE, ROOK_VALUE, QUEEN_VALUE, KING_VALUE
+};
+
+static const Move NO_MOVE = {-1, -1, -1, -1, 0};
+
+// The search state below is thread-local: every search thread (see Lazy SMP) has its own
+// killers, key history, counters and lines. Only the transposition table is shared.
+
+// Quiet moves that caused a beta cutoff, two per ply
+static _Thread_local PackedMove killerMoves[MAX_SEARCH_PLY][2];
+
+// Keys of the game positions before the root followed by the current search line
+static _Thread_local KeyHistory searchKeys;
+
+// Counters of the current search, copied out when the caller asks for them
+static _Thread_local SearchStats searchStats;
+
+// Principal variation of each ply (triangular: the line at ply n is at most MAX_SEARCH_PLY - n long)
+static _Thread_local PackedMove pvTable[MAX_SEARCH_PLY][MAX_SEARCH_PLY];
+static _Thread_local int pvLength[MAX_SEARCH_PLY];
+
+// Every root move of one iteration with its score and the line found below it, kept so
+// the one finally played can be reported
+typedef struct {
+    PackedMove moves[256];
+    int scores[256];          // Exact for moves within the threshold of the best one
+    PackedMove lines[256][MAX_SEARCH_PLY];
+    int lineLengths[256];
+    int count;
+    int best;                 // Index of the highest score
+} RootResult;
+
+static _Thread_local RootResult rootResult;
+static RootResult completedRoot; // Main thread only
+
+// Iterative deepening: the principal variation of the last completed iteration is searched
+// first by the next one, as long as the current line still follows it
+static _Thread_local PackedMove previousPV[MAX_SEARCH_PLY];
+static _Thread_local int previousPVLength;
+static _Thread_local bool followPV;
+
+// Time limit of a timed search (0 for none), checked by the main thread. Once it passes, or
+// the main thread is done, searchStopped is set and every thread unwinds.
+static _Thread_local double searchDeadline;
+static atomic_bool searchStopped;
+
+/* Transposition table
+ * Results of earlier searches by position key: the best move found, the score and whether it
+ * is exact or a bound, the depth searched and the search it came from (its age). Entries are
+ * 16 bytes, grouped four to a 64-byte bucket (one cache line) chosen by the low bits of the
+ * key. A result replaces the entry of its own position if there is one, else the entry worth
+ * least: the shallowest, counting each search of age as several plies of depth. Mate scores
+ * are stored as distances from the node rather than the root, so they stay right when the
+ * position is reached at another ply.
+ * All search threads share the table without locks: the key is stored xor the data, so an
+ * entry torn by two concurrent writers no longer matches its position and is ignored.
+ */
+#define TT_BUCKET_SIZE 4
+#define TT_AGE_MASK 63      // Ages are 6 bits and wrap around
+#define TT_AGE_WEIGHT 8     // Plies of depth one search of age is worth when replacing
+
+typedef enum {
+    TT_NONE,                // Empty entry
+    TT_UPPER,               // Score is at most the stored one
+    TT_LOWER,               // Score is at least the stored one
+    TT_EXACT
+} TTBound;
+
+typedef struct {
+    _Atomic uint64_t key;   // Position key ^ data
+    _Atomic uint64_t data;  // Move (16 bits), score (16), depth (8), bound (2), age (6); 0 when empty
+} TTEntry;
+
+typedef struct {
+    _Alignas(64) TTEntry entries[TT_BUCKET_SIZE];
+} TTBucket;
+
+typedef struct {
+    PackedMove move;
+    int score;              // From the probing node's ply
+    int depth;
+    TTBound bound;
+} TTResult;
+
+static TTBucket *ttBuckets; // NULL until the first search or setHashSize()
+static uint64_t ttMask;     // Bucket count - 1 (a power of two)
+static int ttAge;           // Advanced by every search
+
+/* Lazy SMP
+ * With more than one search thread, helper threads search the same root as the main thread,
+ * each on its own copy of the position, and share what they find only through the
+ * transposition table. Half of them start one ply deeper, so the threads work on different
+ * iterations and fill the table ahead of the main thread. The main thread's result is played;
+ * the helpers are stopped when it is done and their node counts are added to its statistics.
+ */
+typedef struct {
+    pthread_t thread;
+    int index;              // 1 and up; the main thread is 0
+    GameState state;
+    SearchStats stats;      // Counters of the helper's search, once it has stopped
+#ifdef ENGINE_PROFILE
+    ProfileEntry profile[PROF_COUNT]; // Its profile counters, added to the main thread's
+#endif
+} SearchHelper;
+
+static int searchThreads = 1;
+static SearchHelper helpers[MAX_SEARCH_THREADS];
+static KeyHistory rootKeys; // Keys of the game before the root, copied by every helper
+static _Thread_local bool helperThread;
+
+#ifdef SEARCH_TRACE
+// Search tracing: events are buffered and appended to SEARCH_TRACE_FILE, which is created
+// by the first search of the program. Without SEARCH_TRACE the macros compile to nothing.
+#define TRACE_BUFFER_SIZE 4096
+
+static FILE *traceFile;
+static bool traceFailed;
+static TraceEvent traceBuffer[TRACE_BUFFER_SIZE];
+static int traceCount;
+
+// Only the main thread's search is recorded
+static void flushTrace(void) {
+    if (helperThread) {
+        return;
+    }
+    if (traceFile && traceCount > 0) {
+        fwrite(traceBuffer, sizeof(TraceEvent), traceCount, traceFile);
+        fflush(traceFile);
+    }
+    traceCount = 0;
+}
+
+static void traceEvent(TraceEventType type, int depth, PackedMove move, int a, int b) {
+    if (helperThread) {
+        return;
+    }
+    if (!traceFile) {
+        if (traceFailed) {
+            return;
+        }
+        traceFile = fopen(SEARCH_TRACE_FILE, "wb");
+        if (!traceFile) {
+            fprintf(stderr, "Cannot create %s\n", SEARCH_TRACE_FILE);
+            traceFailed = true;
+            return;
+        }
+        uint32_t version = TRACE_VERSION;
+        fwrite(TRACE_MAGIC, 1, 4, traceFile);
+        fwrite(&version, sizeof(version), 1, traceFile);
+    }
+    
+    if (traceCount == TRACE_BUFFER_SIZE) {
+        flushTrace();
+    }
+    
+    TraceEvent *event = &traceBuffer[traceCount++];
+    event->type = (uint8_t)type;
+    event->depth = (int8_t)depth;
+    event->move = move;
+    event->a = (int16_t)a;
+    event->b = (int16_t)b;
+}
+
+#define TRACE(type, depth, move, a, b) traceEvent((type), (depth), (move), (a), (b))
+#define TRACE_RETURN(score) do { \
+        int traceScore = (score); \
+        traceEvent(TRACE_EXIT, 0, PACKED_MOVE_NONE, traceScore, 0); \
+        return traceScore; \
+    } while (0)
+#define TRACE_FLUSH() flushTrace()
+#else
+#define TRACE(type, depth, move, a, b) ((void)0)
+#define TRACE_RETURN(score) return (score)
+#define TRACE_FLUSH() ((void)0)
+#endif
+
+// Moves generated in the capture stage: captures, en passant and queen promotions
+static bool isTacticalMove(const GameState *state, PackedMove move) {
+    int from = PACKED_FROM(move);
+    int to = PACKED_TO(move);
+    return (state->occupiedBB & SQUARE_BB(to)) ||
+           ((state->pieceBB[state->turn][PAWN] & SQUARE_BB(from)) && SQUARE_COL(from) != SQUARE_COL(to)) ||
+           PACKED_PROMOTION(move) == QUEEN;
+}
+
+// Remember a quiet move that refuted the position at this ply
+static void storeKiller(int ply, PackedMove move) {
+    if (ply >= MAX_SEARCH_PLY || killerMoves[ply][0] == move) {
+        return;
+    }
+    killerMoves[ply][1] = killerMoves[ply][0];
+    killerMoves[ply][0] = move;
+}
+
+// Static exchange evaluation: material outcome of the capture sequence on the target square,
+// each side always recapturing with its least valuable attacker
+int staticExchangeEval(const GameState *state, PackedMove move) {
+    PROFILE_SCOPE(PROF_STATIC_EXCHANGE_EVAL);
+    
+    int to = PACKED_TO(move);
+    int from = PACKED_FROM(move);
+    Piece target = state->board[SQUARE_ROW(to)][SQUARE_COL(to)];
+    int attackerType = GET_PIECE_TYPE(state->board[SQUARE_ROW(from)][SQUARE_COL(from)]);
+    Bitboard occupied = state->occupiedBB;
+    int gain[32];
+    int depth = 0;
+    
+    if (target != EMPTY) {
+        gain[0] = pieceValues[GET_PIECE_TYPE(target)];
+    } else if (attackerType == PAWN && SQUARE_COL(from) != SQUARE_COL(to)) {
+        gain[0] = PAWN_VALUE;
+        occupied ^= SQUARE_BB(SQUARE_INDEX(SQUARE_ROW(from), SQUARE_COL(to))); // En passant victim
+    } else {
+        gain[0] = 0;
+    }
+    
+    Bitboard diagonalSliders = state->pieceBB[WHITE][BISHOP] | state->pieceBB[BLACK][BISHOP] |
+                               state->pieceBB[WHITE][QUEEN] | state->pieceBB[BLACK][QUEEN];
+    Bitboard straightSliders = state->pieceBB[WHITE][ROOK] | state->pieceBB[BLACK][ROOK] |
+                               state->pieceBB[WHITE][QUEEN] | state->pieceBB[BLACK][QUEEN];
+    Bitboard attackers = attackersTo(state, to, WHITE, occupied) | attackersTo(state, to, BLACK, occupied);
+    Bitboard fromBB = SQUARE_BB(from);
+    Color side = state->turn;
+    
+    while (fromBB && depth < 31) {
+        depth++;
+        gain[depth] = pieceValues[attackerType] - gain[depth - 1];
+        if ((-gain[depth - 1] > gain[depth] ? -gain[depth - 1] : gain[depth]) < 0) {
+            break; // Neither side can improve by continuing
+        }
+        
+        // Remove the capturer and reveal any slider behind it
+        occupied ^= fromBB;
+        attackers |= (bishopAttacks(to, occupied) & diagonalSliders) |
+                     (rookAttacks(to, occupied) & straightSliders);
+        attackers &= occupied;
+        side = !side;
+        
+        // Next capturer: the least valuable attacker of the side to recapture
+        fromBB = 0;
+        for (int type = PAWN; type <= KING; type++) {
+            Bitboard candidates = attackers & state->pieceBB[side][type];
+            if (candidates) {
+                fromBB = candidates & -candidates;
+                attackerType = type;
+                break;
+            }
+        }
+    }
+    
+    while (--depth > 0) {
+        gain[depth - 1] = -((-gain[depth - 1] > gain[depth]) ? -gain[depth - 1] : gain[depth]);
+    }
+    
+    return gain[0];
+}
 
-// AI selection of the best move using minimax with alpha-beta pruning
+// Prepare a picker for the current position
+void initMovePicker(MovePicker *picker, const GameState *state, PackedMove hashMove, const PackedMove killers[2]) {
+    picker->state = state;
+    picker->stage = PICK_HASH_MOVE;
+    picker->hashMove = hashMove;
+    picker->killers[0] = killers ? killers[0] : PACKED_MOVE_NONE;
+    picker->killers[1] = killers ? killers[1] : PACKED_MOVE_NONE;
+    picker->killerIndex = 0;
+    picker->captureIndex = 0;
+    picker->badCaptureCount = 0;
+    picker->badCaptureIndex = 0;
+    picker->quietIndex = 0;
+}
+
+// Hand out the next move, generating stages on demand. Returns false when no moves are left.
+bool nextMove(MovePicker *picker, PackedMove *move) {
+    const GameState *state = picker->state;
+    
+    switch (picker->stage) {
+        case PICK_HASH_MOVE:
+            picker->stage = PICK_GENERATE_CAPTURES;
+            if (picker->hashMove != PACKED_MOVE_NONE && isValidMove(state, unpackMove(picker->hashMove))) {
+                *move = picker->hashMove;
+                return true;
+            }
+            // fall through
+        
+        case PICK_GENERATE_CAPTURES:
+            generatePackedMoves(state, &picker->captures, GEN_CAPTURES);
+            for (int i = 0; i < picker->captures.count; i++) {
+                PackedMove m = picker->captures.moves[i];
+                int from = PACKED_FROM(m);
+                int to = PACKED_TO(m);
+                Piece victim = state->board[SQUARE_ROW(to)][SQUARE_COL(to)];
+                int attackerType = GET_PIECE_TYPE(state->board[SQUARE_ROW(from)][SQUARE_COL(from)]);
+                int victimValue = (victim != EMPTY) ? pieceValues[GET_PIECE_TYPE(victim)] :
+                                  (SQUARE_COL(from) != SQUARE_COL(to)) ? PAWN_VALUE : 0; // En passant or quiet promotion
+                picker->captures.scores[i] = victimValue * 8 - attackerType + pieceValues[PACKED_PROMOTION(m)];
+            }
+            picker->stage = PICK_GOOD_CAPTURES;
+            // fall through
+        
+        case PICK_GOOD_CAPTURES:
+            while (picker->captureIndex < picker->captures.count) {
+                // Selection sort step: bring the best remaining capture forward
+                int best = picker->captureIndex;
+                for (int i = best + 1; i < picker->captures.count; i++) {
+                    if (picker->captures.scores[i] > picker->captures.scores[best]) {
+                        best = i;
+                    }
+                }
+                
+                PackedMove m = picker->captures.moves[best];
+                picker->captures.moves[best] = picker->captures.moves[picker->captureIndex];
+                picker->captures.scores[best] = picker->captures.scores[picker->captureIndex];
+                picker->captureIndex++;
+                
+                if (m == picker->hashMove) {
+                    continue;
+                }
+                
+                // Losing captures wait until after the quiet moves
+                if (staticExchangeEval(state, m) < 0) {
+                    picker->captures.moves[picker->badCaptureCount++] = m;
+                    continue;
+                }
+                
+                *move = m;
+                return true;
+            }
+            picker->stage = PICK_KILLERS;
+            // fall through
+        
+        case PICK_KILLERS:
+            while (picker->killerIndex < 2) {
+                PackedMove m = picker->killers[picker->killerIndex++];
+                if (m != PACKED_MOVE_NONE && m != picker->hashMove &&
+                    !isTacticalMove(state, m) && isValidMove(state, unpackMove(m))) {
+                    *move = m;
+                    return true;
+                }
+            }
+            picker->stage = PICK_GENERATE_QUIETS;
+            // fall through
+        
+        case PICK_GENERATE_QUIETS:
+            generatePackedMoves(state, &picker->quiets, GEN_QUIETS);
+            picker->stage = PICK_QUIETS;
+            // fall through
+        
+        case PICK_QUIETS:
+            while (picker->quietIndex < picker->quiets.count) {
+                PackedMove m = picker->quiets.moves[picker->quietIndex++];
+                if (m != picker->hashMove && m != picker->killers[0] && m != picker->killers[1]) {
+                    *move = m;
+                    return true;
+                }
+            }
+            picker->stage = PICK_BAD_CAPTURES;
+            // fall through
+        
+        case PICK_BAD_CAPTURES:
+            if (picker->badCaptureIndex < picker->badCaptureCount) {
+                *move = picker->captures.moves[picker->badCaptureIndex++];
+                return true;
+            }
+            picker->stage = PICK_DONE;
+            // fall through
+        
+        case PICK_DONE:
+            break;
+    }
+    
+    return false;
+}
+
+// AI selection of the best move using alpha-beta search
 Move getBestMove(GameState *state, AIDifficulty difficulty) {
-    MoveList moves;
-    generateMoves(state, &moves);
+    return getBestMoveWithHistory(state, difficulty, NULL, NULL);
+}
+
+// Best move found within a time budget in milliseconds
+Move getBestMoveTimed(GameState *state, int milliseconds) {
+    return getBestMoveTimedWithHistory(state, milliseconds, NULL, NULL);
+}
+
+// Allocate the largest power-of-two table that fits in the given number of megabytes (at
+// least 1). The old table is kept if the size is invalid or cannot be allocated.
+bool setHashSize(int megabytes) {
+    if (megabytes < 1) {
+        return false;
+    }
     
-    if (moves.count == 0) {
-        // No legal moves
-        Move nullMove = {-1, -1, -1, -1, 0};
-        return nullMove;
+    uint64_t maxCount = ((uint64_t)megabytes * 1024 * 1024) / sizeof(TTBucket);
+    uint64_t count = 1;
+    while (count <= maxCount / 2) {
+        count *= 2;
     }
     
-    // Seed random number generator
-    srand((unsigned int)time(NULL));
+    TTBucket *buckets = aligned_alloc(sizeof(TTBucket), count * sizeof(TTBucket));
+    if (!buckets) {
+        return false;
+    }
     
-    // Initialize history for undoing moves
-    GameHistory history;
-    memset(&history, 0, sizeof(GameHistory));
+    free(ttBuckets);
+    ttBuckets = buckets;
+    ttMask = count - 1;
+    clearHash();
+    return true;
+}
+
+// Forget all stored results, e.g. before an unrelated game
+void clearHash(void) {
+    if (ttBuckets) {
+        memset(ttBuckets, 0, (ttMask + 1) * sizeof(TTBucket));
+    }
+    ttAge = 0;
+}
+
+static inline bool isMateScore(int score) {
+    return abs(score) > MATE_SCORE - MAX_SEARCH_PLY;
+}
+
+// Mate scores count plies from the root in the search and from the node in the table
+static inline int scoreToTT(int score, int ply) {
+    return isMateScore(score) ? score + ((score > 0) ? ply : -ply) : score;
+}
+
+static inline int scoreFromTT(int score, int ply) {
+    return isMateScore(score) ? score - ((score > 0) ? ply : -ply) : score;
+}
+
+// Look up the position; false if the table holds nothing for it
+static bool probeTT(uint64_t key, int ply, TTResult *result) {
+    if (!ttBuckets) {
+        return false;
+    }
+    
+    searchStats.ttProbes++;
+    TTEntry *bucket = ttBuckets[key & ttMask].entries;
+    for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+        uint64_t entryKey = atomic_load_explicit(&bucket[i].key, memory_order_relaxed);
+        uint64_t data = atomic_load_explicit(&bucket[i].data, memory_order_relaxed);
+        if ((entryKey ^ data) == key && data != 0) {
+            searchStats.ttHits++;
+            result->move = (PackedMove)(data & 0xFFFF);
+            result->score = scoreFromTT((int16_t)(data >> 16), ply);
+            result->depth = (int)((data >> 32) & 0xFF);
+            result->bound = (TTBound)((data >> 40) & 3);
+            return true;
+        }
+    }
     
-    int bestScore = INT_MIN;
-    int bestMoveIndex = 0;
-    int alpha = INT_MIN;
-    int beta = INT_MAX;
+    return false;
+}
+
+static void storeTT(uint64_t key, int ply, int depth, int score, TTBound bound, PackedMove move) {
+    if (!ttBuckets) {
+        return;
+    }
     
-    // Calculate scores for all moves
-    int *scores = malloc(moves.count * sizeof(int));
+    TTEntry *bucket = ttBuckets[key & ttMask].entries;
+    TTEntry *entry = NULL;
+    int lowestWorth = INT_MAX;
     
-    for (int i = 0; i < moves.count; i++) {
-        // Make move
-        makeMove(state, moves.moves[i], &history);
+    for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+        uint64_t entryKey = atomic_load_explicit(&bucket[i].key, memory_order_relaxed);
+        uint64_t data = atomic_load_explicit(&bucket[i].data, memory_order_relaxed);
+        if (data == 0 || (entryKey ^ data) == key) {
+            entry = &bucket[i];
+            if (data == 0) {
+                break;
+            }
+            
+            // A deeper result of this search is worth more than a shallower bound (e.g. from
+            // quiescence); only its move is refreshed
+            int entryDepth = (int)((data >> 32) & 0xFF);
+            int entryAge = (int)(data >> 42);
+            if (entryAge == ttAge && entryDepth > depth && bound != TT_EXACT) {
+                if (move != PACKED_MOVE_NONE && move != (PackedMove)(data & 0xFFFF)) {
+                    data = (data & ~(uint64_t)0xFFFF) | move;
+                    atomic_store_explicit(&entry->key, key ^ data, memory_order_relaxed);
+                    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+                }
+                return;
+            }
+            
+            // A bound without a move keeps the move found by an earlier search of the position
+            if (move == PACKED_MOVE_NONE) {
+                move = (PackedMove)(data & 0xFFFF);
+            }
+            break;
+        }
         
-        // Evaluate with minimax
-        scores[i] = -minimax(state, difficulty - 1, -beta, -alpha, false, &history);
+        int age = (ttAge - (int)(data >> 42)) & TT_AGE_MASK;
+        int worth = (int)((data >> 32) & 0xFF) - age * TT_AGE_WEIGHT;
+        if (worth < lowestWorth) {
+            lowestWorth = worth;
+            entry = &bucket[i];
+        }
+    }
+    
+    uint64_t data = (uint64_t)move | (uint64_t)(uint16_t)scoreToTT(score, ply) << 16 |
+                    (uint64_t)depth << 32 | (uint64_t)bound << 40 | (uint64_t)ttAge << 42;
+    atomic_store_explicit(&entry->key, key ^ data, memory_order_relaxed);
+    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+}
+
+static inline bool isStopped(void) {
+    return atomic_load_explicit(&searchStopped, memory_order_relaxed);
+}
+
+// Checked every 1024 nodes: stop the search once the deadline has passed
+static inline bool timeUp(void) {
+    if (searchDeadline > 0 && (searchStats.nodes & 1023) == 0 && nowSeconds() >= searchDeadline) {
+        atomic_store_explicit(&searchStopped, true, memory_order_relaxed);
+    }
+    return isStopped();
+}
+
+// The line at ply becomes move followed by the line found below it
+static void updatePV(int ply, PackedMove move) {
+    if (ply >= MAX_SEARCH_PLY) {
+        return;
+    }
+    
+    int childLength = (ply + 1 < MAX_SEARCH_PLY) ? pvLength[ply + 1] : 0;
+    if (childLength > MAX_SEARCH_PLY - ply - 1) {
+        childLength = MAX_SEARCH_PLY - ply - 1;
+    }
+    
+    pvTable[ply][0] = move;
+    if (childLength > 0) {
+        memcpy(&pvTable[ply][1], &pvTable[ply + 1][0], childLength * sizeof(PackedMove));
+    }
+    pvLength[ply] = childLength + 1;
+}
+
+// Fill in the derived statistics and hand them to the caller
+static void finishSearchStats(SearchStats *stats, double startTime) {
+    searchStats.seconds = nowSeconds() - startTime;
+    searchStats.nps = (searchStats.seconds > 0) ? searchStats.nodes / searchStats.seconds : 0;
+    searchStats.firstMoveCutoffRate = searchStats.cutoffs ?
+        (double)searchStats.firstMoveCutoffs / searchStats.cutoffs : 0;
+    *stats = searchStats;
+}
+
+// Clear the per-search state: counters, killers, and the positions of the game so far
+static void startSearch(const GameHistory *history) {
+    memset(&searchStats, 0, sizeof(searchStats));
+    searchStats.nodes = 1; // The root
+    searchStats.plyNodes[0] = 1;
+    memset(killerMoves, 0, sizeof(killerMoves));
+    collectHistoryKeys(history, &searchKeys);
+    previousPVLength = 0;
+    followPV = false;
+    searchDeadline = 0;
+    atomic_store(&searchStopped, false);
+    
+    if (!ttBuckets) {
+        setHashSize(DEFAULT_HASH_MB);
+    }
+    ttAge = (ttAge + 1) & TT_AGE_MASK;
+}
+
+// Search every root move to the given depth. The first move of the previous iteration's
+// principal variation, or else the table's move, is searched first. Returns false if the
+// time ran out, in which case the result is incomplete.
+static bool searchRoot(GameState *state, int depth, RootResult *result) {
+    TRACE(TRACE_SEARCH, depth, PACKED_MOVE_NONE, 0, 0);
+    TRACE(TRACE_NODE, depth, PACKED_MOVE_NONE, -SCORE_INFINITY, SCORE_INFINITY);
+    
+    const int threshold = 10; // Within 0.1 pawns of the best move
+    TTResult tt;
+    PackedMove pvMove = PACKED_MOVE_NONE;
+    if (previousPVLength > 0) {
+        pvMove = previousPV[0];
+    } else if (probeTT(state->hashKey, 0, &tt)) {
+        pvMove = tt.move;
+    }
+    int bestScore = -SCORE_INFINITY;
+    result->count = 0;
+    result->best = 0;
+    
+    MovePicker picker;
+    PackedMove move;
+    initMovePicker(&picker, state, pvMove, NULL);
+    
+    while (nextMove(&picker, &move)) {
+        // Moves that cannot come within the threshold of the best only need a bound
+        int alpha = (result->count == 0) ? -SCORE_INFINITY : bestScore - threshold - 1;
         
-        // Undo move
-        undoMove(state, &history);
+        MoveUndo undo;
+        TRACE(TRACE_MOVE, 0, move, 0, 0);
+        followPV = (move == pvMove);
+        searchKeys.keys[searchKeys.count++] = state->hashKey;
+        doMove(state, move, &undo);
+        int score = -minimax(state, depth - 1, 1, -SCORE_INFINITY, -alpha);
+        unmakeMove(state, &undo);
+        searchKeys.count--;
+        followPV = false;
         
-        if (scores[i] > bestScore) {
-            bestScore = scores[i];
-            bestMoveIndex = i;
+        if (isStopped()) {
+            break;
         }
         
-        // Update alpha for alpha-beta pruning
-        if (scores[i] > alpha) {
-            alpha = scores[i];
+        // The line below the move is exact when its score is
+        int index = result->count++;
+        updatePV(0, move);
+        memcpy(result->lines[index], pvTable[0], pvLength[0] * sizeof(PackedMove));
+        result->lineLengths[index] = pvLength[0];
+        result->moves[index] = move;
+        result->scores[index] = score;
+        
+        if (score > bestScore) {
+            bestScore = score;
+            result->best = index;
+        }
+    }
+    
+    bool completed = !isStopped();
+    if (completed && result->count > 0) {
+        storeTT(state->hashKey, 0, depth, bestScore, TT_EXACT, result->moves[result->best]);
+    }
+    
+    TRACE(TRACE_EXIT, 0, PACKED_MOVE_NONE,
+          (result->count > 0) ? bestScore : (isInCheck(state, state->turn) ? -MATE_SCORE : 0), 0);
+    TRACE_FLUSH();
+    
+    return completed;
+}
+
+// Pick the move to play from a root search: one of the moves scoring within the threshold
+// of the best, at random to add variety. Fills in stats when it is not NULL.
+static Move chooseRootMove(const GameState *state, const RootResult *result, SearchStats *stats,
+                           double startTime) {
+    if (result->count == 0) {
+        // No legal moves
+        if (stats) {
+            searchStats.score = isInCheck(state, state->turn) ? -MATE_SCORE : 0;
+            finishSearchStats(stats, startTime);
         }
+        return NO_MOVE;
     }
     
     // Find all moves that have a score close to the best score
-    int threshold = 10; // Within 0.1 pawns of the best move
+    const int threshold = 10;
+    int bestScore = result->scores[result->best];
+    int goodMoves[256];
     int goodMoveCount = 0;
-    int *goodMoves = malloc(moves.count * sizeof(int));
     
-    for (int i = 0; i < moves.count; i++) {
-        if (scores[i] >= bestScore - threshold) {
+    for (int i = 0; i < result->count; i++) {
+        if (result->scores[i] >= bestScore - threshold) {
             goodMoves[goodMoveCount++] = i;
         }
     }
     
     // Randomly select from good moves to add variety
-    if (goodMoveCount > 1) {
-        bestMoveIndex = goodMoves[rand() % goodMoveCount];
+    int chosen = goodMoves[rand() % goodMoveCount];
+    
+    if (stats) {
+        searchStats.score = result->scores[chosen];
+        searchStats.pvLength = result->lineLengths[chosen];
+        memcpy(searchStats.pv, result->lines[chosen], result->lineLengths[chosen] * sizeof(PackedMove));
+        finishSearchStats(stats, startTime);
     }
     
-    free(scores);
-    free(goodMoves);
+    return unpackMove(result->moves[chosen]);
+}
+
+// Number of threads searching each position, 1 (the default) to MAX_SEARCH_THREADS
+void setSearchThreads(int count) {
+    searchThreads = (count < 1) ? 1 : (count > MAX_SEARCH_THREADS) ? MAX_SEARCH_THREADS : count;
+}
+
+// Helper thread: searches its copy of the root one ply deeper each time until the main thread
+// stops the search. Its thread-local state starts out zeroed.
+static void *helperSearch(void *arg) {
+    SearchHelper *helper = arg;
+    helperThread = true;
+    searchKeys = rootKeys;
     
-    return moves.moves[bestMoveIndex];
+    for (int depth = 1 + helper->index % 2; depth < MAX_SEARCH_PLY; depth++) {
+        followPV = false;
+        if (!searchRoot(&helper->state, depth, &rootResult) || rootResult.count == 0) {
+            break;
+        }
+        
+        int best = rootResult.best;
+        previousPVLength = rootResult.lineLengths[best];
+        memcpy(previousPV, rootResult.lines[best], previousPVLength * sizeof(PackedMove));
+    }
+    
+    helper->stats = searchStats;
+#ifdef ENGINE_PROFILE
+    memcpy(helper->profile, profileEntries, sizeof(helper->profile));
+#endif
+    return NULL;
 }
 
-// Minimax algorithm with alpha-beta pruning
-int minimax(GameState *state, int depth, int alpha, int beta, bool maximizing, GameHistory *history) {
-    // Check for checkmate, stalemate, or draw
-    if (isCheckmate(state)) {
-        return maximizing ? -10000 : 10000;
+// Start the helper threads on copies of the root. Returns how many started; if one cannot be
+// created, the search goes on with fewer.
+static int startHelpers(const GameState *state) {
+    rootKeys = searchKeys;
+    
+    int started = 0;
+    for (int i = 1; i < searchThreads; i++) {
+        SearchHelper *helper = &helpers[i - 1];
+        helper->index = i;
+        helper->state = *state;
+        if (pthread_create(&helper->thread, NULL, helperSearch, helper) != 0) {
+            break;
+        }
+        started++;
     }
     
-    if (isStalemate(state) || isDraw(state)) {
-        return 0;
+    return started;
+}
+
+// Stop and join the helpers, adding their counters (and profile) to the main thread's
+static void stopHelpers(int count) {
+    atomic_store(&searchStopped, true);
+    
+    for (int i = 0; i < count; i++) {
+        pthread_join(helpers[i].thread, NULL);
+        const SearchStats *helperStats = &helpers[i].stats;
+        searchStats.nodes += helperStats->nodes;
+        searchStats.qnodes += helperStats->qnodes;
+        searchStats.cutoffs += helperStats->cutoffs;
+        searchStats.firstMoveCutoffs += helperStats->firstMoveCutoffs;
+        searchStats.ttProbes += helperStats->ttProbes;
+        searchStats.ttHits += helperStats->ttHits;
+        for (int ply = 0; ply < MAX_SEARCH_PLY; ply++) {
+            searchStats.plyNodes[ply] += helperStats->plyNodes[ply];
+        }
+#ifdef ENGINE_PROFILE
+        profileAdd(helpers[i].profile);
+#endif
     }
+}
+
+// Best move for a position reached through the given game, so repetitions of earlier
+// positions are scored as draws (history may be NULL). The search counters are copied
+// to stats when it is not NULL.
+Move getBestMoveWithHistory(GameState *state, AIDifficulty difficulty, const GameHistory *history,
+                            SearchStats *stats) {
+    // The random choice among equal moves uses the generator seeded once by the program
+    // (main), so a search itself is deterministic and benchmarks are reproducible
+    double startTime = stats ? nowSeconds() : 0;
+    startSearch(history);
+    searchStats.depth = difficulty;
     
-    // Base case: reached max depth
-    if (depth <= 0) {
-        return quiescenceSearch(state, alpha, beta, history);
+    int helperCount = startHelpers(state);
+    searchRoot(state, difficulty, &rootResult);
+    stopHelpers(helperCount);
+    return chooseRootMove(state, &rootResult, stats, startTime);
+}
+
+// Root result for a timed search stopped before depth 1 completed: the root moves searched
+// so far, else the table's move, else the first legal move (none if there are no legal moves)
+static void fallbackRootMove(GameState *state, RootResult *result) {
+    if (rootResult.count > 0) {
+        *result = rootResult;
+        return;
+    }
+    
+    TTResult tt;
+    PackedMove move = PACKED_MOVE_NONE;
+    if (probeTT(state->hashKey, 0, &tt) && tt.move != PACKED_MOVE_NONE &&
+        isValidMove(state, unpackMove(tt.move))) {
+        move = tt.move;
+    } else {
+        ScoredMoveList moves;
+        generatePackedMoves(state, &moves, GEN_ALL);
+        if (moves.count > 0) {
+            move = moves.moves[0];
+        }
     }
     
-    MoveList moves;
-    generateMoves(state, &moves);
+    result->count = 0;
+    result->best = 0;
+    if (move != PACKED_MOVE_NONE) {
+        result->moves[0] = move;
+        result->scores[0] = 0; // Not searched
+        result->lines[0][0] = move;
+        result->lineLengths[0] = 1;
+        result->count = 1;
+    }
+}
+
+/* Iterative deepening within a time budget
+ * Searches depth 1, 2, 3... and plays from the last iteration that completed. Each iteration
+ * searches the principal variation of the previous one first and keeps its killer moves, so
+ * the deeper search starts from good move ordering. An iteration still running when the time
+ * runs out is abandoned, and none is started once half the budget is used, since it could not
+ * finish. If even depth 1 is cut short, a move is still returned (see fallbackRootMove).
+ */
+Move getBestMoveTimedWithHistory(GameState *state, int milliseconds, const GameHistory *history,
+                                 SearchStats *stats) {
+    double startTime = nowSeconds();
+    double budget = milliseconds / 1000.0;
+    startSearch(history);
+    completedRoot.count = 0;
+    int helperCount = startHelpers(state);
     
-    if (maximizing) {
-        int maxEval = INT_MIN;
+    for (int depth = 1; depth < MAX_SEARCH_PLY; depth++) {
+        searchDeadline = startTime + budget;
+        followPV = false;
+        if (!searchRoot(state, depth, &rootResult)) {
+            break;
+        }
         
-        for (int i = 0; i < moves.count; i++) {
-            makeMove(state, moves.moves[i], history);
-            int eval = minimax(state, depth - 1, alpha, beta, false, history);
-            undoMove(state, history);
-            
-            maxEval = (eval > maxEval) ? eval : maxEval;
-            alpha = (alpha > maxEval) ? alpha : maxEval;
-            
-            if (beta <= alpha) {
-                break; // Beta cutoff
-            }
+        completedRoot = rootResult;
+        searchStats.depth = depth;
+        if (completedRoot.count == 0) {
+            break;
         }
         
-        return maxEval;
+        // The best line so far orders the next iteration
+        int best = completedRoot.best;
+        previousPVLength = completedRoot.lineLengths[best];
+        memcpy(previousPV, completedRoot.lines[best], previousPVLength * sizeof(PackedMove));
+        
+        int bestScore = completedRoot.scores[best];
+        if (abs(bestScore) > MATE_SCORE - MAX_SEARCH_PLY || nowSeconds() - startTime > budget / 2) {
+            break; // A forced mate needs no deeper search, and another iteration would not finish
+        }
+    }
+    
+    searchDeadline = 0;
+    stopHelpers(helperCount);
+    if (searchStats.depth == 0) {
+        fallbackRootMove(state, &completedRoot);
+    }
+    return chooseRootMove(state, &completedRoot, stats, startTime);
+}
+
+// Alpha-beta search in negamax form: scores are from the side to move's point of view
+int minimax(GameState *state, int depth, int ply, int alpha, int beta) {
+    searchStats.nodes++;
+    if (ply < MAX_SEARCH_PLY) {
+        searchStats.plyNodes[ply]++;
+        pvLength[ply] = 0;
+    }
+    TRACE(TRACE_NODE, depth, PACKED_MOVE_NONE, alpha, beta);
+    
+    // Out of time: the score is discarded by the root
+    if (timeUp()) {
+        TRACE_RETURN(0);
+    }
+    
+    // Check for draws that do not depend on the moves available. A position that already
+    // occurred in the search line counts as a draw: repeating it again is always possible.
+    if (isSearchRepetition(&searchKeys, state) || isFiftyMoveDraw(state) || isInsufficientMaterial(state)) {
+        TRACE_RETURN(0);
+    }
+    
+    // Base case: reached max depth (a mate on the horizon still scores as mate)
+    if (depth <= 0) {
+        if (isCheckmate(state)) {
+            TRACE_RETURN(-MATE_SCORE + ply);
+        }
+        TRACE_RETURN(quiescenceSearch(state, alpha, beta));
+    }
+    
+    // A stored result searched at least as deep settles the node if its bound is good enough;
+    // otherwise its move is tried first
+    TTResult tt;
+    PackedMove hashMove = PACKED_MOVE_NONE;
+    if (probeTT(state->hashKey, ply, &tt)) {
+        hashMove = tt.move;
+        if (tt.depth >= depth) {
+            if (tt.score >= beta && tt.bound != TT_UPPER) {
+                TRACE_RETURN(beta);
+            }
+            if (tt.score <= alpha && tt.bound != TT_LOWER) {
+                TRACE_RETURN(alpha);
+            }
+            if (tt.bound == TT_EXACT) {
+                // The line below is not stored; the move at least keeps it from ending here
+                if (tt.move != PACKED_MOVE_NONE && ply < MAX_SEARCH_PLY) {
+                    pvTable[ply][0] = tt.move;
+                    pvLength[ply] = 1;
+                }
+                TRACE_RETURN(tt.score);
+            }
+        }
+    }
+    
+    // While on the previous iteration's principal variation, its move here is tried first
+    if (followPV && ply < previousPVLength) {
+        hashMove = previousPV[ply];
     } else {
-        int minEval = INT_MAX;
+        followPV = false;
+    }
+    
+    MovePicker picker;
+    PackedMove move;
+    PackedMove bestMove = PACKED_MOVE_NONE;
+    int legalMoves = 0;
+    initMovePicker(&picker, state, hashMove, (ply < MAX_SEARCH_PLY) ? killerMoves[ply] : NULL);
+    
+    while (nextMove(&picker, &move)) {
+        legalMoves++;
         
-        for (int i = 0; i < moves.count; i++) {
-            makeMove(state, moves.moves[i], history);
-            int eval = minimax(state, depth - 1, alpha, beta, true, history);
-            undoMove(state, history);
-            
-            minEval = (eval < minEval) ? eval : minEval;
-            beta = (beta < minEval) ? beta : minEval;
-            
-            if (beta <= alpha) {
-                break; // Alpha cutoff
+        bool quiet = !isTacticalMove(state, move);
+        MoveUndo undo;
+        TRACE(TRACE_MOVE, 0, move, 0, 0);
+        followPV = followPV && move == hashMove;
+        searchKeys.keys[searchKeys.count++] = state->hashKey;
+        doMove(state, move, &undo);
+        int score = -minimax(state, depth - 1, ply + 1, -beta, -alpha);
+        unmakeMove(state, &undo);
+        searchKeys.count--;
+        followPV = false;
+        
+        if (isStopped()) {
+            TRACE_RETURN(0);
+        }
+        
+        if (score >= beta) {
+            searchStats.cutoffs++;
+            if (legalMoves == 1) {
+                searchStats.firstMoveCutoffs++;
+            }
+            if (quiet) {
+                storeKiller(ply, move);
             }
+            storeTT(state->hashKey, ply, depth, beta, TT_LOWER, move);
+            TRACE(TRACE_CUTOFF, 0, move, score, 0);
+            TRACE_RETURN(beta); // Beta cutoff: the remaining stages are never generated
         }
         
-        return minEval;
+        if (score > alpha) {
+            alpha = score;
+            bestMove = move;
+            updatePV(ply, move);
+        }
+    }
+    
+    // No legal moves: checkmate or stalemate
+    if (legalMoves == 0) {
+        TRACE_RETURN(isInCheck(state, state->turn) ? -MATE_SCORE + ply : 0);
     }
+    
+    storeTT(state->hashKey, ply, depth, alpha, (bestMove != PACKED_MOVE_NONE) ? TT_EXACT : TT_UPPER, bestMove);
+    TRACE_RETURN(alpha);
 }
 
 // Quiescence search to avoid horizon effect
-int quiescenceSearch(GameState *state, int alpha, int beta, GameHistory *history) {
+int quiescenceSearch(GameState *state, int alpha, int beta) {
+    searchStats.nodes++;
+    searchStats.qnodes++;
+    TRACE(TRACE_QNODE, 0, PACKED_MOVE_NONE, alpha, beta);
+    
+    if (timeUp()) {
+        TRACE_RETURN(0);
+    }
+    
+    // Any stored result is deep enough here. The node has no ply, so mate scores (which the
+    // window may hold) are neither used nor stored.
+    TTResult tt;
+    PackedMove hashMove = PACKED_MOVE_NONE;
+    bool storable = !isMateScore(alpha) && !isMateScore(beta);
+    if (probeTT(state->hashKey, 0, &tt)) {
+        hashMove = tt.move;
+        if (!isMateScore(tt.score)) {
+            if (tt.score >= beta && tt.bound != TT_UPPER) {
+                TRACE_RETURN(beta);
+            }
+            if (tt.score <= alpha && tt.bound != TT_LOWER) {
+                TRACE_RETURN(alpha);
+            }
+            if (tt.bound == TT_EXACT) {
+                TRACE_RETURN(tt.score);
+            }
+        }
+    }
+    
     int standPat = evaluatePosition(state);
     
     if (standPat >= beta) {
-        return beta;
+        TRACE_RETURN(beta);
     }
     
+    int originalAlpha = alpha;
     if (alpha < standPat) {
         alpha = standPat;
     }
     
-    MoveList moves;
-    generateMoves(state, &moves);
+    // Only tactical moves: captures, en passant and queen promotions
+    ScoredMoveList captureMoves;
+    generatePackedMoves(state, &captureMoves, GEN_CAPTURES);
     
-    // Filter for captures only
-    MoveList captureMoves;
-    captureMoves.count = 0;
-    
-    for (int i = 0; i < moves.count; i++) {
-        Move move = moves.moves[i];
-        Piece targetPiece = getPiece(state, move.toRow, move.toCol);
-        
-        // Include only captures
-        if (targetPiece != EMPTY) {
-            captureMoves.moves[captureMoves.count++] = move;
+    // The stored move goes first
+    for (int i = 1; i < captureMoves.count; i++) {
+        if (captureMoves.moves[i] == hashMove) {
+            captureMoves.moves[i] = captureMoves.moves[0];
+            captureMoves.moves[0] = hashMove;
+            break;
         }
     }
     
+    PackedMove bestMove = PACKED_MOVE_NONE;
     for (int i = 0; i < captureMoves.count; i++) {
-        makeMove(state, captureMoves.moves[i], history);
-        int score = -quiescenceSearch(state, -beta, -alpha, history);
-        undoMove(state, history);
+        MoveUndo undo;
+        TRACE(TRACE_MOVE, 0, captureMoves.moves[i], 0, 0);
+        doMove(state, captureMoves.moves[i], &undo);
+        int score = -quiescenceSearch(state, -beta, -alpha);
+        unmakeMove(state, &undo);
+        
+        if (isStopped()) {
+            TRACE_RETURN(0);
+        }
         
         if (score >= beta) {
-            return beta;
+            searchStats.cutoffs++;
+            if (i == 0) {
+                searchStats.firstMoveCutoffs++;
+            }
+            if (storable) {
+                storeTT(state->hashKey, 0, 0, beta, TT_LOWER, captureMoves.moves[i]);
+            }
+            TRACE(TRACE_CUTOFF, 0, captureMoves.moves[i], score, 0);
+            TRACE_RETURN(beta);
         }
         
         if (score > alpha) {
             alpha = score;
+            bestMove = captureMoves.moves[i];
         }
     }
     
-    return alpha;
+    if (storable) {
+        storeTT(state->hashKey, 0, 0, alpha, (alpha > originalAlpha) ? TT_EXACT : TT_UPPER, bestMove);
+    }
+    TRACE_RETURN(alpha);
 }
 
 // Evaluate the current position
 int evaluatePosition(const GameState *state) {
+    PROFILE_SCOPE(PROF_EVALUATE_POSITION);
+    
     // Calculate material and positional scores
     int score = materialScore(state);
     
@@ -294,48 +1160,43 @@ int evaluatePosition(const GameState *state) {
 
 // Calculate total material score and piece positioning
 int materialScore(const GameState *state) {
-    int score = 0;
     bool endgame = isEndgame(state);
     
-    for (int row = 0; row < BOARD_SIZE; row++) {
-        for (int col = 0; col < BOARD_SIZE; col++) {
-            Piece piece = getPiece(state, row, col);
-            if (piece == EMPTY) continue;
-            
-            int pieceType = GET_PIECE_TYPE(piece);
-            int color = GET_PIECE_COLOR(piece);
-            int square = (color == WHITE) ? (row * 8 + col) : ((7 - row) * 8 + col);
-            
-            // Material value
-            int value = 0;
-            switch (pieceType) {
-                case PAWN: value = PAWN_VALUE; break;
-                case KNIGHT: value = KNIGHT_VALUE; break;
-                case BISHOP: value = BISHOP_VALUE; break;
-                case ROOK: value = ROOK_VALUE; break;
-                case QUEEN: value = QUEEN_VALUE; break;
-                case KING: value = KING_VALUE; break;
-            }
-            
-            // Position value
-            int posValue = 0;
-            switch (pieceType) {
-                case PAWN: posValue = PAWN_TABLE[square]; break;
-                case KNIGHT: posValue = KNIGHT_TABLE[square]; break;
-                case BISHOP: posValue = BISHOP_TABLE[square]; break;
-                case ROOK: posValue = ROOK_TABLE[square]; break;
-                case QUEEN: posValue = QUEEN_TABLE[square]; break;
-                case KING: 
-                    posValue = endgame ? KING_TABLE_END[square] : KING_TABLE_MIDDLE[square]; 
-                    break;
-            }
-            
-            // Add or subtract based on piece color
-            if (color == WHITE) {
-                score += value + posValue;
-            } else {
-                score -= value + posValue;
-            }
+    // Material value, kept up to date by setPiece
+    int score = state->material[WHITE] - state->material[BLACK] +
+                (state->pieceCount[WHITE][KING] - state->pieceCount[BLACK][KING]) * KING_VALUE;
+    
+    Bitboard occupied = state->occupiedBB;
+    while (occupied) {
+        int boardSquare = LSB_INDEX(occupied);
+        POP_LSB(occupied);
+        
+        int row = SQUARE_ROW(boardSquare);
+        int col = SQUARE_COL(boardSquare);
+        Piece piece = state->board[row][col];
+        
+        int pieceType = GET_PIECE_TYPE(piece);
+        int color = GET_PIECE_COLOR(piece);
+        int square = (color == WHITE) ? (row * 8 + col) : ((7 - row) * 8 + col);
+        
+        // Position value
+        int posValue = 0;
+        switch (pieceType) {
+            case PAWN: posValue = PAWN_TABLE[square]; break;
+            case KNIGHT: posValue = KNIGHT_TABLE[square]; break;
+            case BISHOP: posValue = BISHOP_TABLE[square]; break;
+            case ROOK: posValue = ROOK_TABLE[square]; break;
+            case QUEEN: posValue = QUEEN_TABLE[square]; break;
+            case KING: 
+                posValue = endgame ? KING_TABLE_END[square] : KING_TABLE_MIDDLE[square]; 
+                break;
+        }
+        
+        // Add or subtract based on piece color
+        if (color == WHITE) {
+            score += posValue;
+        } else {
+            score -= posValue;
         }
     }
     
@@ -344,6 +1205,8 @@ int materialScore(const GameState *state) {
 
 // Evaluate piece mobility
 int mobilityScore(const GameState *state) {
+    PROFILE_SCOPE(PROF_MOBILITY_SCORE);
+    
     const int MOBILITY_WEIGHT = 10;
     
     // Count legal moves for each side
@@ -379,30 +1242,18 @@ int pawnStructureScore(const GameState *state) {
     const int ISOLATED_PAWN_PENALTY = -20;
     const int PASSED_PAWN_BONUS = 30;
     
+    Bitboard whitePawns = state->pieceBB[WHITE][PAWN];
+    Bitboard blackPawns = state->pieceBB[BLACK][PAWN];
+    
     // Check each file for white and black pawns
     for (int col = 0; col < BOARD_SIZE; col++) {
-        int whitePawnsInFile = 0;
-        int blackPawnsInFile = 0;
-        int whiteLowestPawn = -1;
-        int blackHighestPawn = -1;
-        
-        for (int row = 0; row < BOARD_SIZE; row++) {
-            Piece piece = getPiece(state, row, col);
-            
-            if (GET_PIECE_TYPE(piece) == PAWN) {
-                if (GET_PIECE_COLOR(piece) == WHITE) {
-                    whitePawnsInFile++;
-                    if (whiteLowestPawn == -1 || row < whiteLowestPawn) {
-                        whiteLowestPawn = row;
-                    }
-                } else {
-                    blackPawnsInFile++;
-                    if (blackHighestPawn == -1 || row > blackHighestPawn) {
-                        blackHighestPawn = row;
-                    }
-                }
-            }
-        }
+        Bitboard fileMask = FILE_BB(col);
+        Bitboard adjacentFiles = ((col > 0) ? FILE_BB(col - 1) : 0) |
+                                 ((col < BOARD_SIZE - 1) ? FILE_BB(col + 1) : 0);
+        Bitboard whiteInFile = whitePawns & fileMask;
+        Bitboard blackInFile = blackPawns & fileMask;
+        int whitePawnsInFile = POP_COUNT(whiteInFile);
+        int blackPawnsInFile = POP_COUNT(blackInFile);
         
         // Doubled pawns penalty
         if (whitePawnsInFile > 1) {
@@ -413,105 +1264,28 @@ int pawnStructureScore(const GameState *state) {
         }
         
         // Isolated pawns penalty
-        if (whitePawnsInFile > 0) {
-            bool isIsolated = true;
-            
-            if (col > 0) {
-                for (int row = 0; row < BOARD_SIZE; row++) {
-                    Piece leftPiece = getPiece(state, row, col - 1);
-                    if (GET_PIECE_TYPE(leftPiece) == PAWN && GET_PIECE_COLOR(leftPiece) == WHITE) {
-                        isIsolated = false;
-                        break;
-                    }
-                }
-            }
-            
-            if (isIsolated && col < BOARD_SIZE - 1) {
-                for (int row = 0; row < BOARD_SIZE; row++) {
-                    Piece rightPiece = getPiece(state, row, col + 1);
-                    if (GET_PIECE_TYPE(rightPiece) == PAWN && GET_PIECE_COLOR(rightPiece) == WHITE) {
-                        isIsolated = false;
-                        break;
-                    }
-                }
-            }
-            
-            if (isIsolated) {
-                score += ISOLATED_PAWN_PENALTY;
-            }
+        if (whitePawnsInFile > 0 && !(whitePawns & adjacentFiles)) {
+            score += ISOLATED_PAWN_PENALTY;
         }
-        
-        if (blackPawnsInFile > 0) {
-            bool isIsolated = true;
-            
-            if (col > 0) {
-                for (int row = 0; row < BOARD_SIZE; row++) {
-                    Piece leftPiece = getPiece(state, row, col - 1);
-                    if (GET_PIECE_TYPE(leftPiece) == PAWN && GET_PIECE_COLOR(leftPiece) == BLACK) {
-                        isIsolated = false;
-                        break;
-                    }
-                }
-            }
-            
-            if (isIsolated && col < BOARD_SIZE - 1) {
-                for (int row = 0; row < BOARD_SIZE; row++) {
-                    Piece rightPiece = getPiece(state, row, col + 1);
-                    if (GET_PIECE_TYPE(rightPiece) == PAWN && GET_PIECE_COLOR(rightPiece) == BLACK) {
-                        isIsolated = false;
-                        break;
-                    }
-                }
-            }
-            
-            if (isIsolated) {
-                score -= ISOLATED_PAWN_PENALTY;
-            }
+        if (blackPawnsInFile > 0 && !(blackPawns & adjacentFiles)) {
+            score -= ISOLATED_PAWN_PENALTY;
         }
         
-        // Passed pawns bonus
-        if (whitePawnsInFile > 0 && whiteLowestPawn != -1) {
-            bool isPassed = true;
-            
-            // Check if there are any black pawns that can block this pawn
-            for (int checkCol = col - 1; checkCol <= col + 1; checkCol++) {
-                if (checkCol < 0 || checkCol >= BOARD_SIZE) continue;
-                
-                for (int row = whiteLowestPawn + 1; row < BOARD_SIZE; row++) {
-                    Piece piece = getPiece(state, row, checkCol);
-                    if (GET_PIECE_TYPE(piece) == PAWN && GET_PIECE_COLOR(piece) == BLACK) {
-                        isPassed = false;
-                        break;
-                    }
-                }
-                
-                if (!isPassed) break;
-            }
+        // Passed pawns bonus: no enemy pawn ahead on this or an adjacent file
+        if (whitePawnsInFile > 0) {
+            int whiteLowestPawn = SQUARE_ROW(LSB_INDEX(whiteInFile));
+            Bitboard ahead = (whiteLowestPawn < BOARD_SIZE - 1) ? (~0ULL << ((whiteLowestPawn + 1) * BOARD_SIZE)) : 0;
             
-            if (isPassed) {
+            if (!(blackPawns & (fileMask | adjacentFiles) & ahead)) {
                 score += PASSED_PAWN_BONUS + (whiteLowestPawn * 5);
             }
         }
         
-        if (blackPawnsInFile > 0 && blackHighestPawn != -1) {
-            bool isPassed = true;
-            
-            // Check if there are any white pawns that can block this pawn
-            for (int checkCol = col - 1; checkCol <= col + 1; checkCol++) {
-                if (checkCol < 0 || checkCol >= BOARD_SIZE) continue;
-                
-                for (int row = blackHighestPawn - 1; row >= 0; row--) {
-                    Piece piece = getPiece(state, row, checkCol);
-                    if (GET_PIECE_TYPE(piece) == PAWN && GET_PIECE_COLOR(piece) == WHITE) {
-                        isPassed = false;
-                        break;
-                    }
-                }
-                
-                if (!isPassed) break;
-            }
+        if (blackPawnsInFile > 0) {
+            int blackHighestPawn = SQUARE_ROW(MSB_INDEX(blackInFile));
+            Bitboard ahead = SQUARE_BB(blackHighestPawn * BOARD_SIZE) - 1;
             
-            if (isPassed) {
+            if (!(whitePawns & (fileMask | adjacentFiles) & ahead)) {
                 score -= PASSED_PAWN_BONUS + ((7 - blackHighestPawn) * 5);
             }
         }
@@ -526,30 +1300,17 @@ int kingSafetyScore(const GameState *state) {
     const int KING_EXPOSED_PENALTY = -15;
     
     int score = 0;
-    int whiteKingRow = -1, whiteKingCol = -1;
-    int blackKingRow = -1, blackKingCol = -1;
-    
-    // Find kings
-    for (int row = 0; row < BOARD_SIZE; row++) {
-        for (int col = 0; col < BOARD_SIZE; col++) {
-            Piece piece = getPiece(state, row, col);
-            if (GET_PIECE_TYPE(piece) == KING) {
-                if (GET_PIECE_COLOR(piece) == WHITE) {
-                    whiteKingRow = row;
-                    whiteKingCol = col;
-                } else {
-                    blackKingRow = row;
-                    blackKingCol = col;
-                }
-            }
-        }
-    }
     
     // Early return if kings not found (shouldn't happen)
-    if (whiteKingRow == -1 || blackKingRow == -1) {
+    if (state->kingSquare[WHITE] < 0 || state->kingSquare[BLACK] < 0) {
         return 0;
     }
     
+    int whiteKingRow = SQUARE_ROW(state->kingSquare[WHITE]);
+    int whiteKingCol = SQUARE_COL(state->kingSquare[WHITE]);
+    int blackKingRow = SQUARE_ROW(state->kingSquare[BLACK]);
+    int blackKingCol = SQUARE_COL(state->kingSquare[BLACK]);
+    
     // Evaluate white king safety
     if (!isEndgame(state)) {
         // Castled kingside
@@ -661,35 +1422,7 @@ int centerControlScore(const GameState *state) {
 
 // Determine if the game is in the endgame phase
 bool isEndgame(const GameState *state) {
-    int whiteValue = 0;
-    int blackValue = 0;
-    
-    for (int row = 0; row < BOARD_SIZE; row++) {
-        for (int col = 0; col < BOARD_SIZE; col++) {
-            Piece piece = getPiece(state, row, col);
-            if (piece == EMPTY) continue;
-            
-            int pieceType = GET_PIECE_TYPE(piece);
-            int pieceValue = 0;
-            
-            switch (pieceType) {
-                case PAWN: pieceValue = PAWN_VALUE; break;
-                case KNIGHT: pieceValue = KNIGHT_VALUE; break;
-                case BISHOP: pieceValue = BISHOP_VALUE; break;
-                case ROOK: pieceValue = ROOK_VALUE; break;
-                case QUEEN: pieceValue = QUEEN_VALUE; break;
-                case KING: continue; // Skip king
-            }
-            
-            if (GET_PIECE_COLOR(piece) == WHITE) {
-                whiteValue += pieceValue;
-            } else {
-                blackValue += pieceValue;
-            }
-        }
-    }
-    
     // Endgame if both players have less than a queen + rook in material
     const int ENDGAME_THRESHOLD = QUEEN_VALUE + ROOK_VALUE;
-    return (whiteValue < ENDGAME_THRESHOLD && blackValue < ENDGAME_THRESHOLD);
-}
\ No newline at end of file
+    return (state->material[WHITE] < ENDGAME_THRESHOLD && state->material[BLACK] < ENDGAME_THRESHOLD);
+}
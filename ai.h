@@ -11,6 +11,60 @@ typedef enum {
     AI_EXPERT = 5    // 5 plies
 } AIDifficulty;
 
+// Search limits and scores
+#define MAX_SEARCH_PLY 64
+#define SCORE_INFINITY 30000
+#define MATE_SCORE 10000      // Mate at the root; mates further away score slightly less
+#define DEFAULT_HASH_MB 16    // Transposition table size unless setHashSize() is called first
+#define MAX_SEARCH_THREADS 64
+
+// Search statistics and the line found, filled in by getBestMoveWithHistory and
+// getBestMoveTimedWithHistory when asked for
+typedef struct {
+    int depth;                 // Depth searched, in plies (the last completed iteration if timed)
+    int score;                 // Score of the move played, from the side to move's point of view
+    PackedMove pv[MAX_SEARCH_PLY]; // Principal variation, starting with the move played
+    int pvLength;
+    uint64_t nodes;            // Main search and quiescence nodes, the root included
+    uint64_t qnodes;           // Quiescence nodes
+    uint64_t plyNodes[MAX_SEARCH_PLY]; // Main search nodes at each ply from the root
+    uint64_t cutoffs;          // Beta cutoffs after searching a move
+    uint64_t firstMoveCutoffs; // Cutoffs by the first move searched
+    double firstMoveCutoffRate; // firstMoveCutoffs / cutoffs, a measure of move ordering
+    uint64_t ttProbes;         // Transposition table lookups
+    uint64_t ttHits;           // Lookups that found the position
+    double seconds;            // Elapsed time
+    double nps;                // Nodes per second
+} SearchStats;
+
+// Stages of the move picker, in the order moves are handed out
+typedef enum {
+    PICK_HASH_MOVE,
+    PICK_GENERATE_CAPTURES,
+    PICK_GOOD_CAPTURES,
+    PICK_KILLERS,
+    PICK_GENERATE_QUIETS,
+    PICK_QUIETS,
+    PICK_BAD_CAPTURES,
+    PICK_DONE
+} PickerStage;
+
+// Staged, lazy move picker: each stage is generated only when the previous one runs out,
+// so a node that cuts off early never generates its quiet moves
+typedef struct {
+    const GameState *state;
+    PickerStage stage;
+    PackedMove hashMove;     // Tried first when legal (PACKED_MOVE_NONE if none)
+    PackedMove killers[2];   // Quiet moves that caused cutoffs at this ply
+    int killerIndex;
+    ScoredMoveList captures; // Scored in MVV-LVA order
+    int captureIndex;
+    int badCaptureCount;     // Losing captures, parked at the front of captures
+    int badCaptureIndex;
+    ScoredMoveList quiets;
+    int quietIndex;
+} MovePicker;
+
 // Piece-Square tables used for position evaluation
 extern const int PAWN_TABLE[64];
 extern const int KNIGHT_TABLE[64];
@@ -22,9 +76,20 @@ extern const int KING_TABLE_END[64];
 
 // AI functions
 Move getBestMove(GameState *state, AIDifficulty difficulty);
+Move getBestMoveWithHistory(GameState *state, AIDifficulty difficulty, const GameHistory *history,
+                            SearchStats *stats);
+Move getBestMoveTimed(GameState *state, int milliseconds);
+Move getBestMoveTimedWithHistory(GameState *state, int milliseconds, const GameHistory *history,
+                                 SearchStats *stats);
+bool setHashSize(int megabytes);
+void clearHash(void);
+void setSearchThreads(int count);
 int evaluatePosition(const GameState *state);
-int minimax(GameState *state, int depth, int alpha, int beta, bool maximizing, GameHistory *history);
-int quiescenceSearch(GameState *state, int alpha, int beta, GameHistory *history);
+int minimax(GameState *state, int depth, int ply, int alpha, int beta);
+int quiescenceSearch(GameState *state, int alpha, int beta);
+void initMovePicker(MovePicker *picker, const GameState *state, PackedMove hashMove, const PackedMove killers[2]);
+bool nextMove(MovePicker *picker, PackedMove *move);
+int staticExchangeEval(const GameState *state, PackedMove move);
 bool isEndgame(const GameState *state);
 int materialScore(const GameState *state);
 int mobilityScore(const GameState *state);
@@ -1,12 +1,319 @@
+#define _POSIX_C_SOURCE 199309L // clock_gettime
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 #include "chess.h"
+#include "profile.h"
+
+// Precomputed attack tables, filled once by initAttackTables
+static Bitboard knightAttackTable[64];
+static Bitboard kingAttackTable[64];
+static Bitboard pawnAttackTable[2][64];
+static Bitboard rayTable[8][64];
+static Bitboard betweenTable[64][64]; // Squares strictly between two aligned squares
+static Bitboard lineTable[64][64];    // Full line through two aligned squares
+static bool attackTablesReady = false;
+
+// Zobrist keys, filled once by initZobristKeys
+static uint64_t zobristPieces[2][7][64]; // [color][piece type][square]
+static uint64_t zobristCastling[2][2];   // [color][side], matching castlingRights
+static uint64_t zobristEnPassant[BOARD_SIZE];
+static uint64_t zobristBlackToMove;
+static bool zobristKeysReady = false;
+
+// Material counted in GameState.material, king excluded
+static const int materialValues[7] = {0, PAWN_VALUE, KNIGHT_VALUE, BISHOP_VALUE, ROOK_VALUE, QUEEN_VALUE, 0};
+
+/* Magic bitboards for sliding pieces
+ * The relevant blockers of a square (its rays without the board edge) are multiplied by a
+ * magic number; the top bits of the product index that square's slice of the shared table.
+ * Magics are searched once at startup with a fixed seed, so the tables are reproducible.
+ */
+typedef struct {
+    Bitboard mask;      // Relevant occupancy (rays minus edge squares)
+    Bitboard magic;
+    Bitboard *attacks;  // Slice of the shared attack table
+    int shift;          // 64 - popcount(mask)
+} Magic;
+
+#define ROOK_TABLE_SIZE 102400
+#define BISHOP_TABLE_SIZE 5248
+
+static Magic rookMagics[64];
+static Magic bishopMagics[64];
+static Bitboard rookAttackTable[ROOK_TABLE_SIZE];
+static Bitboard bishopAttackTable[BISHOP_TABLE_SIZE];
+
+#define MAGIC_INDEX(m, occupied) ((unsigned)((((occupied) & (m)->mask) * (m)->magic) >> (m)->shift))
+
+// Slider attacks are a single magic table lookup
+static inline Bitboard bishopAttacksFast(int square, Bitboard occupied) {
+    const Magic *m = &bishopMagics[square];
+    return m->attacks[MAGIC_INDEX(m, occupied)];
+}
+
+static inline Bitboard rookAttacksFast(int square, Bitboard occupied) {
+    const Magic *m = &rookMagics[square];
+    return m->attacks[MAGIC_INDEX(m, occupied)];
+}
+
+// Ray directions as {row step, col step}; the first four move towards higher square indices
+enum { DIR_N, DIR_E, DIR_NE, DIR_NW, DIR_S, DIR_W, DIR_SE, DIR_SW };
+static const int rayDirections[8][2] = {
+    {1, 0}, {0, 1}, {1, 1}, {1, -1},
+    {-1, 0}, {0, -1}, {-1, 1}, {-1, -1}
+};
+
+// Attacks along one ray, stopping at (and including) the first occupied square
+static Bitboard rayAttacks(int dir, int square, Bitboard occupied) {
+    Bitboard attacks = rayTable[dir][square];
+    Bitboard blockers = attacks & occupied;
+    
+    if (blockers) {
+        int blocker = (dir < DIR_S) ? LSB_INDEX(blockers) : MSB_INDEX(blockers);
+        attacks ^= rayTable[dir][blocker];
+    }
+    
+    return attacks;
+}
+
+// Slow ray-walking slider attacks, used only to fill the magic tables
+static Bitboard sliderAttacksSlow(int square, Bitboard occupied, bool diagonal) {
+    if (diagonal) {
+        return rayAttacks(DIR_NE, square, occupied) | rayAttacks(DIR_NW, square, occupied) |
+               rayAttacks(DIR_SE, square, occupied) | rayAttacks(DIR_SW, square, occupied);
+    }
+    return rayAttacks(DIR_N, square, occupied) | rayAttacks(DIR_E, square, occupied) |
+           rayAttacks(DIR_S, square, occupied) | rayAttacks(DIR_W, square, occupied);
+}
+
+// xorshift64* generator for the magic search
+static Bitboard nextRandom(Bitboard *seed) {
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 2685821657736338717ULL;
+}
+
+// Find a magic for every square and fill its slice of the attack table
+static void initMagics(Magic *magics, Bitboard *table, bool diagonal) {
+    static Bitboard occupancies[4096];
+    static Bitboard references[4096];
+    static int epochs[4096];
+    static int epoch = 0;
+    // Per-rank seeds known to find magics quickly with this generator
+    const Bitboard rankSeeds[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
+    Bitboard *slice = table;
+    
+    for (int square = 0; square < 64; square++) {
+        Magic *m = &magics[square];
+        int row = SQUARE_ROW(square);
+        int col = SQUARE_COL(square);
+        
+        // Edge squares never block anything beyond themselves
+        Bitboard edges = ((RANK_BB(0) | RANK_BB(7)) & ~RANK_BB(row)) |
+                         ((FILE_BB(0) | FILE_BB(7)) & ~FILE_BB(col));
+        m->mask = sliderAttacksSlow(square, 0, diagonal) & ~edges;
+        m->shift = 64 - POP_COUNT(m->mask);
+        m->attacks = slice;
+        
+        // Enumerate every subset of the mask (Carry-Rippler) with its attack set
+        int size = 0;
+        Bitboard subset = 0;
+        do {
+            occupancies[size] = subset;
+            references[size] = sliderAttacksSlow(square, subset, diagonal);
+            size++;
+            subset = (subset - m->mask) & m->mask;
+        } while (subset);
+        
+        // Try sparse random candidates until one maps every subset without a bad collision
+        Bitboard seed = rankSeeds[row];
+        for (int i = 0; i < size; ) {
+            do {
+                m->magic = nextRandom(&seed) & nextRandom(&seed) & nextRandom(&seed);
+            } while (POP_COUNT((m->mask * m->magic) >> 56) < 6);
+            
+            epoch++;
+            for (i = 0; i < size; i++) {
+                unsigned index = MAGIC_INDEX(m, occupancies[i]);
+                if (epochs[index] < epoch) {
+                    epochs[index] = epoch;
+                    m->attacks[index] = references[i];
+                } else if (m->attacks[index] != references[i]) {
+                    break;
+                }
+            }
+        }
+        
+        slice += size;
+    }
+}
+
+// Fill the knight, king, pawn, ray and magic tables (safe to call more than once)
+void initAttackTables(void) {
+    if (attackTablesReady) {
+        return;
+    }
+    
+    const int knightMoves[8][2] = {
+        {-2, -1}, {-2, 1}, {-1, -2}, {-1, 2},
+        {1, -2}, {1, 2}, {2, -1}, {2, 1}
+    };
+    const int kingMoves[8][2] = {
+        {-1, -1}, {-1, 0}, {-1, 1}, {0, -1},
+        {0, 1}, {1, -1}, {1, 0}, {1, 1}
+    };
+    
+    for (int square = 0; square < 64; square++) {
+        int row = SQUARE_ROW(square);
+        int col = SQUARE_COL(square);
+        
+        for (int i = 0; i < 8; i++) {
+            int newRow = row + knightMoves[i][0];
+            int newCol = col + knightMoves[i][1];
+            if (newRow >= 0 && newRow < BOARD_SIZE && newCol >= 0 && newCol < BOARD_SIZE) {
+                knightAttackTable[square] |= SQUARE_BB(SQUARE_INDEX(newRow, newCol));
+            }
+            
+            newRow = row + kingMoves[i][0];
+            newCol = col + kingMoves[i][1];
+            if (newRow >= 0 && newRow < BOARD_SIZE && newCol >= 0 && newCol < BOARD_SIZE) {
+                kingAttackTable[square] |= SQUARE_BB(SQUARE_INDEX(newRow, newCol));
+            }
+        }
+        
+        // Squares a pawn of each color on this square attacks
+        for (int dc = -1; dc <= 1; dc += 2) {
+            int newCol = col + dc;
+            if (newCol < 0 || newCol >= BOARD_SIZE) continue;
+            if (row + 1 < BOARD_SIZE) {
+                pawnAttackTable[WHITE][square] |= SQUARE_BB(SQUARE_INDEX(row + 1, newCol));
+            }
+            if (row - 1 >= 0) {
+                pawnAttackTable[BLACK][square] |= SQUARE_BB(SQUARE_INDEX(row - 1, newCol));
+            }
+        }
+        
+        for (int dir = 0; dir < 8; dir++) {
+            int newRow = row + rayDirections[dir][0];
+            int newCol = col + rayDirections[dir][1];
+            while (newRow >= 0 && newRow < BOARD_SIZE && newCol >= 0 && newCol < BOARD_SIZE) {
+                rayTable[dir][square] |= SQUARE_BB(SQUARE_INDEX(newRow, newCol));
+                newRow += rayDirections[dir][0];
+                newCol += rayDirections[dir][1];
+            }
+        }
+    }
+    
+    initMagics(rookMagics, rookAttackTable, false);
+    initMagics(bishopMagics, bishopAttackTable, true);
+    
+    for (int a = 0; a < 64; a++) {
+        for (int b = 0; b < 64; b++) {
+            if (a == b) continue;
+            
+            if (rookAttacksFast(a, 0) & SQUARE_BB(b)) {
+                betweenTable[a][b] = rookAttacksFast(a, SQUARE_BB(b)) & rookAttacksFast(b, SQUARE_BB(a));
+                lineTable[a][b] = (rookAttacksFast(a, 0) & rookAttacksFast(b, 0)) | SQUARE_BB(a) | SQUARE_BB(b);
+            } else if (bishopAttacksFast(a, 0) & SQUARE_BB(b)) {
+                betweenTable[a][b] = bishopAttacksFast(a, SQUARE_BB(b)) & bishopAttacksFast(b, SQUARE_BB(a));
+                lineTable[a][b] = (bishopAttacksFast(a, 0) & bishopAttacksFast(b, 0)) | SQUARE_BB(a) | SQUARE_BB(b);
+            }
+        }
+    }
+    
+    attackTablesReady = true;
+}
+
+// Fill the Zobrist key tables from a fixed seed (safe to call more than once)
+void initZobristKeys(void) {
+    if (zobristKeysReady) {
+        return;
+    }
+    
+    Bitboard seed = 0x9E3779B97F4A7C15ULL;
+    for (int color = 0; color < 2; color++) {
+        for (int type = PAWN; type <= KING; type++) {
+            for (int square = 0; square < 64; square++) {
+                zobristPieces[color][type][square] = nextRandom(&seed);
+            }
+        }
+        zobristCastling[color][0] = nextRandom(&seed);
+        zobristCastling[color][1] = nextRandom(&seed);
+    }
+    for (int col = 0; col < BOARD_SIZE; col++) {
+        zobristEnPassant[col] = nextRandom(&seed);
+    }
+    zobristBlackToMove = nextRandom(&seed);
+    
+    zobristKeysReady = true;
+}
+
+// Key contribution of the castling rights and en passant file
+static uint64_t rightsKey(const bool castlingRights[2][2], int enPassantCol) {
+    uint64_t key = (enPassantCol >= 0) ? zobristEnPassant[enPassantCol] : 0;
+    for (int color = 0; color < 2; color++) {
+        for (int side = 0; side < 2; side++) {
+            if (castlingRights[color][side]) {
+                key ^= zobristCastling[color][side];
+            }
+        }
+    }
+    return key;
+}
+
+// Zobrist key of a position computed from scratch, to validate the incremental key
+uint64_t computeHashKey(const GameState *state) {
+    uint64_t key = rightsKey(state->castlingRights, state->enPassantCol);
+    
+    for (int color = 0; color < 2; color++) {
+        for (int type = PAWN; type <= KING; type++) {
+            Bitboard pieces = state->pieceBB[color][type];
+            while (pieces) {
+                key ^= zobristPieces[color][type][LSB_INDEX(pieces)];
+                POP_LSB(pieces);
+            }
+        }
+    }
+    
+    if (state->turn == BLACK) {
+        key ^= zobristBlackToMove;
+    }
+    
+    return key;
+}
+
+Bitboard knightAttacks(int square) {
+    return knightAttackTable[square];
+}
+
+Bitboard kingAttacks(int square) {
+    return kingAttackTable[square];
+}
+
+Bitboard pawnAttacks(Color color, int square) {
+    return pawnAttackTable[color][square];
+}
+
+Bitboard bishopAttacks(int square, Bitboard occupied) {
+    return bishopAttacksFast(square, occupied);
+}
+
+Bitboard rookAttacks(int square, Bitboard occupied) {
+    return rookAttacksFast(square, occupied);
+}
 
 // Initialize the chess board with pieces in their starting positions
 void initializeGame(GameState *state) {
+    initAttackTables();
+    initZobristKeys();
     memset(state, 0, sizeof(GameState));
+    state->kingSquare[WHITE] = -1;
+    state->kingSquare[BLACK] = -1;
     
     // Set up initial positions for pawns
     for (int col = 0; col < BOARD_SIZE; col++) {
@@ -44,6 +351,8 @@ void initializeGame(GameState *state) {
     state->castlingRights[WHITE][1] = true; // White kingside
     state->castlingRights[BLACK][0] = true; // Black queenside
     state->castlingRights[BLACK][1] = true; // Black kingside
+    
+    state->hashKey = computeHashKey(state);
 }
 
 void resetGame(GameState *state, GameHistory *history) {
@@ -59,131 +368,117 @@ Piece getPiece(const GameState *state, int row, int col) {
     return state->board[row][col];
 }
 
-// Set piece at a specific position
+// Set piece at a specific position, keeping the bitboards, king squares, piece counts, material
+// and hash key in sync
 void setPiece(GameState *state, int row, int col, Piece piece) {
-    if (row >= 0 && row < BOARD_SIZE && col >= 0 && col < BOARD_SIZE) {
-        state->board[row][col] = piece;
+    if (row < 0 || row >= BOARD_SIZE || col < 0 || col >= BOARD_SIZE) {
+        return;
     }
-}
-
-// Check if a square is attacked by a specific color
-bool isSquareAttacked(const GameState *state, int row, int col, Color attackingColor) {
-    // Check for attacking pawns
-    int pawnRow = (attackingColor == WHITE) ? row - 1 : row + 1;
-    if (pawnRow >= 0 && pawnRow < BOARD_SIZE) {
-        // Left diagonal
-        if (col - 1 >= 0) {
-            Piece piece = getPiece(state, pawnRow, col - 1);
-            if (GET_PIECE_TYPE(piece) == PAWN && GET_PIECE_COLOR(piece) == attackingColor) {
-                return true;
-            }
+    
+    Bitboard squareBB = SQUARE_BB(SQUARE_INDEX(row, col));
+    Piece oldPiece = state->board[row][col];
+    
+    if (oldPiece != EMPTY) {
+        Color color = GET_PIECE_COLOR(oldPiece);
+        int type = GET_PIECE_TYPE(oldPiece);
+        state->pieceBB[color][type] &= ~squareBB;
+        state->colorBB[color] &= ~squareBB;
+        state->occupiedBB &= ~squareBB;
+        state->pieceCount[color][type]--;
+        state->material[color] -= materialValues[type];
+        if (type == BISHOP) {
+            state->bishopSquareCount[color][(squareBB & LIGHT_SQUARES_BB) != 0]--;
         }
-        // Right diagonal
-        if (col + 1 < BOARD_SIZE) {
-            Piece piece = getPiece(state, pawnRow, col + 1);
-            if (GET_PIECE_TYPE(piece) == PAWN && GET_PIECE_COLOR(piece) == attackingColor) {
-                return true;
-            }
+        state->hashKey ^= zobristPieces[color][type][SQUARE_INDEX(row, col)];
+        if (type == KING && state->kingSquare[color] == SQUARE_INDEX(row, col)) {
+            state->kingSquare[color] = -1;
         }
     }
     
-    // Knight moves
-    const int knightMoves[8][2] = {
-        {-2, -1}, {-2, 1}, {-1, -2}, {-1, 2},
-        {1, -2}, {1, 2}, {2, -1}, {2, 1}
-    };
-    
-    for (int i = 0; i < 8; i++) {
-        int newRow = row + knightMoves[i][0];
-        int newCol = col + knightMoves[i][1];
-        
-        if (newRow >= 0 && newRow < BOARD_SIZE && newCol >= 0 && newCol < BOARD_SIZE) {
-            Piece piece = getPiece(state, newRow, newCol);
-            if (GET_PIECE_TYPE(piece) == KNIGHT && GET_PIECE_COLOR(piece) == attackingColor) {
-                return true;
-            }
+    state->board[row][col] = piece;
+    
+    if (piece != EMPTY) {
+        Color color = GET_PIECE_COLOR(piece);
+        int type = GET_PIECE_TYPE(piece);
+        state->pieceBB[color][type] |= squareBB;
+        state->colorBB[color] |= squareBB;
+        state->occupiedBB |= squareBB;
+        state->pieceCount[color][type]++;
+        state->material[color] += materialValues[type];
+        if (type == BISHOP) {
+            state->bishopSquareCount[color][(squareBB & LIGHT_SQUARES_BB) != 0]++;
         }
-    }
-    
-    // Directions for sliding pieces (rook, bishop, queen)
-    const int directions[8][2] = {
-        {-1, 0}, {1, 0}, {0, -1}, {0, 1}, // Rook/Queen
-        {-1, -1}, {-1, 1}, {1, -1}, {1, 1} // Bishop/Queen
-    };
-    
-    for (int i = 0; i < 8; i++) {
-        int dr = directions[i][0];
-        int dc = directions[i][1];
-        
-        int newRow = row + dr;
-        int newCol = col + dc;
-        
-        while (newRow >= 0 && newRow < BOARD_SIZE && newCol >= 0 && newCol < BOARD_SIZE) {
-            Piece piece = getPiece(state, newRow, newCol);
-            
-            if (piece != EMPTY) {
-                if (GET_PIECE_COLOR(piece) == attackingColor) {
-                    int pieceType = GET_PIECE_TYPE(piece);
-                    
-                    if (pieceType == QUEEN || 
-                        (pieceType == ROOK && i < 4) ||
-                        (pieceType == BISHOP && i >= 4)) {
-                        return true;
-                    }
-                }
-                break; // Blocked by a piece
-            }
-            
-            newRow += dr;
-            newCol += dc;
+        state->hashKey ^= zobristPieces[color][type][SQUARE_INDEX(row, col)];
+        if (type == KING) {
+            state->kingSquare[color] = SQUARE_INDEX(row, col);
         }
     }
+}
+
+// Test whether a square is attacked by a color for a given occupancy.
+// Pieces on the squares in 'removed' are ignored (captured or vacated).
+static bool isSquareAttackedBB(const GameState *state, int square, Color attackingColor,
+                               Bitboard occupied, Bitboard removed) {
+    const Bitboard *pieces = state->pieceBB[attackingColor];
+    
+    if (pawnAttackTable[!attackingColor][square] & pieces[PAWN] & ~removed) {
+        return true;
+    }
+    if (knightAttackTable[square] & pieces[KNIGHT] & ~removed) {
+        return true;
+    }
+    if (kingAttackTable[square] & pieces[KING] & ~removed) {
+        return true;
+    }
     
-    // King attacks
-    const int kingMoves[8][2] = {
-        {-1, -1}, {-1, 0}, {-1, 1}, {0, -1},
-        {0, 1}, {1, -1}, {1, 0}, {1, 1}
-    };
+    Bitboard diagonal = (pieces[BISHOP] | pieces[QUEEN]) & ~removed;
+    if (diagonal && (bishopAttacksFast(square, occupied) & diagonal)) {
+        return true;
+    }
     
-    for (int i = 0; i < 8; i++) {
-        int newRow = row + kingMoves[i][0];
-        int newCol = col + kingMoves[i][1];
-        
-        if (newRow >= 0 && newRow < BOARD_SIZE && newCol >= 0 && newCol < BOARD_SIZE) {
-            Piece piece = getPiece(state, newRow, newCol);
-            if (GET_PIECE_TYPE(piece) == KING && GET_PIECE_COLOR(piece) == attackingColor) {
-                return true;
-            }
-        }
+    Bitboard straight = (pieces[ROOK] | pieces[QUEEN]) & ~removed;
+    if (straight && (rookAttacksFast(square, occupied) & straight)) {
+        return true;
     }
     
     return false;
 }
 
+// Check if a square is attacked by a specific color
+bool isSquareAttacked(const GameState *state, int row, int col, Color attackingColor) {
+    PROFILE_SCOPE(PROF_IS_SQUARE_ATTACKED);
+    return isSquareAttackedBB(state, SQUARE_INDEX(row, col), attackingColor, state->occupiedBB, 0);
+}
+
 // Check if a king is in check
 bool isInCheck(const GameState *state, Color color) {
-    // Find the king position
-    int kingRow = -1, kingCol = -1;
+    PROFILE_SCOPE(PROF_IS_IN_CHECK);
     
-    for (int row = 0; row < BOARD_SIZE; row++) {
-        for (int col = 0; col < BOARD_SIZE; col++) {
-            Piece piece = getPiece(state, row, col);
-            if (GET_PIECE_TYPE(piece) == KING && GET_PIECE_COLOR(piece) == color) {
-                kingRow = row;
-                kingCol = col;
-                break;
-            }
-        }
-        if (kingRow != -1) break;
-    }
+    int kingSquare = state->kingSquare[color];
     
-    if (kingRow == -1) return false; // King not found (shouldn't happen in a valid game)
+    if (kingSquare < 0) return false; // King not found (shouldn't happen in a valid game)
     
-    return isSquareAttacked(state, kingRow, kingCol, !color);
+    return isSquareAttackedBB(state, kingSquare, !color, state->occupiedBB, 0);
+}
+
+// Check whether a pseudo-legal move would leave the mover's king attacked.
+// Works on occupancy bitboards instead of a scratch copy of the state.
+static bool moveLeavesKingInCheck(const GameState *state, int from, int to, int pieceType,
+                                  int capturedSquare, Bitboard rookShift) {
+    Color us = state->turn;
+    Bitboard removed = (capturedSquare >= 0) ? SQUARE_BB(capturedSquare) : 0;
+    Bitboard occupied = ((state->occupiedBB & ~SQUARE_BB(from) & ~removed) | SQUARE_BB(to)) ^ rookShift;
+    
+    int kingSquare = (pieceType == KING) ? to : state->kingSquare[us];
+    if (kingSquare < 0) return false;
+    
+    return isSquareAttackedBB(state, kingSquare, !us, occupied, removed);
 }
 
 // Validate if a move is legal
 bool isValidMove(const GameState *state, Move move) {
+    PROFILE_SCOPE(PROF_IS_VALID_MOVE);
+    
     int fromRow = move.fromRow;
     int fromCol = move.fromCol;
     int toRow = move.toRow;
@@ -390,308 +685,520 @@ bool isValidMove(const GameState *state, Move move) {
         return false;
     }
     
-    // Make the move temporarily to check if it results in check
-    GameState tempState = *state;
-    Piece movingPiece = getPiece(&tempState, fromRow, fromCol);
-    setPiece(&tempState, toRow, toCol, movingPiece);
-    setPiece(&tempState, fromRow, fromCol, EMPTY);
+    // Work out what the move removes from the board
+    int capturedSquare = (targetPiece != EMPTY) ? SQUARE_INDEX(toRow, toCol) : -1;
+    Bitboard rookShift = 0;
     
     // Handle en passant capture
-    if (pieceType == PAWN && toCol == state->enPassantCol && 
+    if (pieceType == PAWN && toCol == state->enPassantCol && targetPiece == EMPTY &&
         ((state->turn == WHITE && fromRow == 4 && toRow == 5) ||
          (state->turn == BLACK && fromRow == 3 && toRow == 2))) {
         int capturedPawnRow = (state->turn == WHITE) ? 4 : 3;
-        setPiece(&tempState, capturedPawnRow, toCol, EMPTY);
+        capturedSquare = SQUARE_INDEX(capturedPawnRow, toCol);
     }
     
     // Handle castling rook movement
     if (pieceType == KING && abs(toCol - fromCol) == 2) {
         int row = (state->turn == WHITE) ? 0 : 7;
         if (toCol == 6) { // Kingside
-            setPiece(&tempState, row, 5, getPiece(&tempState, row, 7));
-            setPiece(&tempState, row, 7, EMPTY);
+            rookShift = SQUARE_BB(SQUARE_INDEX(row, 7)) | SQUARE_BB(SQUARE_INDEX(row, 5));
         } else if (toCol == 2) { // Queenside
-            setPiece(&tempState, row, 3, getPiece(&tempState, row, 0));
-            setPiece(&tempState, row, 0, EMPTY);
+            rookShift = SQUARE_BB(SQUARE_INDEX(row, 0)) | SQUARE_BB(SQUARE_INDEX(row, 3));
         }
     }
     
     // Check if the move leaves the king in check
-    bool inCheck = isInCheck(&tempState, state->turn);
-    
-    return !inCheck;
+    return !moveLeavesKingInCheck(state, SQUARE_INDEX(fromRow, fromCol), SQUARE_INDEX(toRow, toCol),
+                                  pieceType, capturedSquare, rookShift);
 }
 
-// Generate all legal moves for the current player
-void generateMoves(const GameState *state, MoveList *moves) {
+// Append a candidate move if it passes full validation
+static void addValidMove(const GameState *state, MoveList *moves, int from, int to, int promotionPiece) {
+    Move move = {SQUARE_ROW(from), SQUARE_COL(from), SQUARE_ROW(to), SQUARE_COL(to), promotionPiece};
+    if (isValidMove(state, move)) {
+        moves->moves[moves->count++] = move;
+    }
+}
+
+// Reference generator: tries every pseudo-legal candidate through isValidMove.
+// Slow, but kept as an oracle for checking generateMoves.
+void generateMovesReference(const GameState *state, MoveList *moves) {
     moves->count = 0;
     
-    for (int fromRow = 0; fromRow < BOARD_SIZE; fromRow++) {
-        for (int fromCol = 0; fromCol < BOARD_SIZE; fromCol++) {
-            Piece piece = getPiece(state, fromRow, fromCol);
-            
-            if (piece == EMPTY || GET_PIECE_COLOR(piece) != state->turn) {
-                continue;
-            }
-            
-            int pieceType = GET_PIECE_TYPE(piece);
-            
-            switch (pieceType) {
-                case PAWN: {
-                    int direction = (state->turn == WHITE) ? 1 : -1;
-                    int startRow = (state->turn == WHITE) ? 1 : 6;
-                    int promotionRow = (state->turn == WHITE) ? 7 : 0;
-                    
-                    // Forward moves
-                    int newRow = fromRow + direction;
-                    if (newRow >= 0 && newRow < BOARD_SIZE) {
-                        // Single step forward
-                        if (getPiece(state, newRow, fromCol) == EMPTY) {
-                            if (newRow == promotionRow) {
-                                // Pawn promotion
-                                for (int p = KNIGHT; p <= QUEEN; p++) {
-                                    Move move = {fromRow, fromCol, newRow, fromCol, p};
-                                    if (isValidMove(state, move)) {
-                                        moves->moves[moves->count++] = move;
-                                    }
-                                }
-                            } else {
-                                Move move = {fromRow, fromCol, newRow, fromCol, 0};
-                                if (isValidMove(state, move)) {
-                                    moves->moves[moves->count++] = move;
-                                }
-                            }
-                            
-                            // Double step from starting position
-                            if (fromRow == startRow) {
-                                newRow = fromRow + 2 * direction;
-                                if (getPiece(state, newRow, fromCol) == EMPTY) {
-                                    Move move = {fromRow, fromCol, newRow, fromCol, 0};
-                                    if (isValidMove(state, move)) {
-                                        moves->moves[moves->count++] = move;
-                                    }
-                                }
-                            }
-                        }
-                        
-                        // Captures
-                        for (int dc = -1; dc <= 1; dc += 2) {
-                            int newCol = fromCol + dc;
-                            if (newCol >= 0 && newCol < BOARD_SIZE) {
-                                Piece targetPiece = getPiece(state, newRow, newCol);
-                                bool isCapture = (targetPiece != EMPTY && GET_PIECE_COLOR(targetPiece) != state->turn);
-                                bool isEnPassant = (state->enPassantCol == newCol &&
-                                                   ((state->turn == WHITE && fromRow == 4) ||
-                                                    (state->turn == BLACK && fromRow == 3)));
-                                
-                                if (isCapture || isEnPassant) {
-                                    if (newRow == promotionRow) {
-                                        // Promotion with capture
-                                        for (int p = KNIGHT; p <= QUEEN; p++) {
-                                            Move move = {fromRow, fromCol, newRow, newCol, p};
-                                            if (isValidMove(state, move)) {
-                                                moves->moves[moves->count++] = move;
-                                            }
-                                        }
-                                    } else {
-                                        Move move = {fromRow, fromCol, newRow, newCol, 0};
-                                        if (isValidMove(state, move)) {
-                                            moves->moves[moves->count++] = move;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    break;
-                }
-                
-                case KNIGHT: {
-                    const int knightMoves[8][2] = {
-                        {-2, -1}, {-2, 1}, {-1, -2}, {-1, 2},
-                        {1, -2}, {1, 2}, {2, -1}, {2, 1}
-                    };
-                    
-                    for (int i = 0; i < 8; i++) {
-                        int newRow = fromRow + knightMoves[i][0];
-                        int newCol = fromCol + knightMoves[i][1];
-                        
-                        if (newRow >= 0 && newRow < BOARD_SIZE && newCol >= 0 && newCol < BOARD_SIZE) {
-                            Move move = {fromRow, fromCol, newRow, newCol, 0};
-                            if (isValidMove(state, move)) {
-                                moves->moves[moves->count++] = move;
-                            }
-                        }
-                    }
-                    break;
-                }
+    Color us = state->turn;
+    Bitboard own = state->colorBB[us];
+    Bitboard enemy = state->colorBB[!us];
+    Bitboard empty = ~state->occupiedBB;
+    Bitboard pieces = own;
+    
+    while (pieces) {
+        int from = LSB_INDEX(pieces);
+        POP_LSB(pieces);
+        
+        int pieceType = GET_PIECE_TYPE(state->board[SQUARE_ROW(from)][SQUARE_COL(from)]);
+        Bitboard targets = 0;
+        
+        switch (pieceType) {
+            case PAWN: {
+                int direction = (us == WHITE) ? 1 : -1;
+                int startRow = (us == WHITE) ? 1 : 6;
+                int promotionRow = (us == WHITE) ? 7 : 0;
+                int fromRow = SQUARE_ROW(from);
+                int oneStep = from + direction * BOARD_SIZE;
                 
-                case BISHOP: {
-                    const int directions[4][2] = {
-                        {-1, -1}, {-1, 1}, {1, -1}, {1, 1}
-                    };
+                // Forward moves
+                if (oneStep >= 0 && oneStep < 64 && (empty & SQUARE_BB(oneStep))) {
+                    targets |= SQUARE_BB(oneStep);
                     
-                    for (int i = 0; i < 4; i++) {
-                        int dr = directions[i][0];
-                        int dc = directions[i][1];
-                        
-                        for (int dist = 1; dist < BOARD_SIZE; dist++) {
-                            int newRow = fromRow + dist * dr;
-                            int newCol = fromCol + dist * dc;
-                            
-                            if (newRow < 0 || newRow >= BOARD_SIZE || newCol < 0 || newCol >= BOARD_SIZE) {
-                                break;
-                            }
-                            
-                            Move move = {fromRow, fromCol, newRow, newCol, 0};
-                            if (isValidMove(state, move)) {
-                                moves->moves[moves->count++] = move;
-                            }
-                            
-                            // Stop if we hit a piece
-                            if (getPiece(state, newRow, newCol) != EMPTY) {
-                                break;
-                            }
-                        }
+                    // Double step from starting position
+                    int twoStep = oneStep + direction * BOARD_SIZE;
+                    if (fromRow == startRow && (empty & SQUARE_BB(twoStep))) {
+                        targets |= SQUARE_BB(twoStep);
                     }
-                    break;
                 }
                 
-                case ROOK: {
-                    const int directions[4][2] = {
-                        {-1, 0}, {1, 0}, {0, -1}, {0, 1}
-                    };
-                    
-                    for (int i = 0; i < 4; i++) {
-                        int dr = directions[i][0];
-                        int dc = directions[i][1];
-                        
-                        for (int dist = 1; dist < BOARD_SIZE; dist++) {
-                            int newRow = fromRow + dist * dr;
-                            int newCol = fromCol + dist * dc;
-                            
-                            if (newRow < 0 || newRow >= BOARD_SIZE || newCol < 0 || newCol >= BOARD_SIZE) {
-                                break;
-                            }
-                            
-                            Move move = {fromRow, fromCol, newRow, newCol, 0};
-                            if (isValidMove(state, move)) {
-                                moves->moves[moves->count++] = move;
-                            }
-                            
-                            // Stop if we hit a piece
-                            if (getPiece(state, newRow, newCol) != EMPTY) {
-                                break;
-                            }
-                        }
-                    }
-                    break;
+                // Captures, including en passant onto the square behind the pawn
+                Bitboard captureTargets = enemy;
+                int epRow = (us == WHITE) ? 4 : 3;
+                if (state->enPassantCol >= 0 && fromRow == epRow) {
+                    captureTargets |= SQUARE_BB(SQUARE_INDEX(epRow + direction, state->enPassantCol));
                 }
+                targets |= pawnAttackTable[us][from] & captureTargets;
                 
-                case QUEEN: {
-                    const int directions[8][2] = {
-                        {-1, 0}, {1, 0}, {0, -1}, {0, 1},
-                        {-1, -1}, {-1, 1}, {1, -1}, {1, 1}
-                    };
+                while (targets) {
+                    int to = LSB_INDEX(targets);
+                    POP_LSB(targets);
                     
-                    for (int i = 0; i < 8; i++) {
-                        int dr = directions[i][0];
-                        int dc = directions[i][1];
-                        
-                        for (int dist = 1; dist < BOARD_SIZE; dist++) {
-                            int newRow = fromRow + dist * dr;
-                            int newCol = fromCol + dist * dc;
-                            
-                            if (newRow < 0 || newRow >= BOARD_SIZE || newCol < 0 || newCol >= BOARD_SIZE) {
-                                break;
-                            }
-                            
-                            Move move = {fromRow, fromCol, newRow, newCol, 0};
-                            if (isValidMove(state, move)) {
-                                moves->moves[moves->count++] = move;
-                            }
-                            
-                            // Stop if we hit a piece
-                            if (getPiece(state, newRow, newCol) != EMPTY) {
-                                break;
-                            }
+                    if (SQUARE_ROW(to) == promotionRow) {
+                        for (int p = KNIGHT; p <= QUEEN; p++) {
+                            addValidMove(state, moves, from, to, p);
                         }
+                    } else {
+                        addValidMove(state, moves, from, to, 0);
                     }
-                    break;
                 }
+                continue;
+            }
+            
+            case KNIGHT:
+                targets = knightAttackTable[from];
+                break;
+            
+            case BISHOP:
+                targets = bishopAttacksFast(from, state->occupiedBB);
+                break;
+            
+            case ROOK:
+                targets = rookAttacksFast(from, state->occupiedBB);
+                break;
+            
+            case QUEEN:
+                targets = bishopAttacksFast(from, state->occupiedBB) | rookAttacksFast(from, state->occupiedBB);
+                break;
+            
+            case KING: {
+                targets = kingAttackTable[from];
                 
-                case KING: {
-                    // Normal king moves
-                    const int kingMoves[8][2] = {
-                        {-1, -1}, {-1, 0}, {-1, 1}, {0, -1},
-                        {0, 1}, {1, -1}, {1, 0}, {1, 1}
-                    };
+                // Castling moves
+                if (!isInCheck(state, us)) {
+                    int row = (us == WHITE) ? 0 : 7;
                     
-                    for (int i = 0; i < 8; i++) {
-                        int newRow = fromRow + kingMoves[i][0];
-                        int newCol = fromCol + kingMoves[i][1];
-                        
-                        if (newRow >= 0 && newRow < BOARD_SIZE && newCol >= 0 && newCol < BOARD_SIZE) {
-                            Move move = {fromRow, fromCol, newRow, newCol, 0};
-                            if (isValidMove(state, move)) {
-                                moves->moves[moves->count++] = move;
-                            }
-                        }
+                    // Kingside castling
+                    if (state->castlingRights[us][1]) {
+                        addValidMove(state, moves, SQUARE_INDEX(row, 4), SQUARE_INDEX(row, 6), 0);
                     }
                     
-                    // Castling moves
-                    if (!isInCheck(state, state->turn)) {
-                        int row = (state->turn == WHITE) ? 0 : 7;
-                        
-                        // Kingside castling
-                        if (state->castlingRights[state->turn][1]) {
-                            Move move = {row, 4, row, 6, 0};
-                            if (isValidMove(state, move)) {
-                                moves->moves[moves->count++] = move;
-                            }
-                        }
-                        
-                        // Queenside castling
-                        if (state->castlingRights[state->turn][0]) {
-                            Move move = {row, 4, row, 2, 0};
-                            if (isValidMove(state, move)) {
-                                moves->moves[moves->count++] = move;
-                            }
-                        }
+                    // Queenside castling
+                    if (state->castlingRights[us][0]) {
+                        addValidMove(state, moves, SQUARE_INDEX(row, 4), SQUARE_INDEX(row, 2), 0);
                     }
-                    break;
                 }
+                break;
+            }
+        }
+        
+        targets &= ~own;
+        while (targets) {
+            int to = LSB_INDEX(targets);
+            POP_LSB(targets);
+            addValidMove(state, moves, from, to, 0);
+        }
+    }
+}
+
+// Append a move that is already known to be legal
+static inline void addMove(ScoredMoveList *moves, int from, int to, int promotionPiece) {
+    moves->moves[moves->count++] = PACK_MOVE(from, to, promotionPiece);
+}
+
+// Append a move to every target square
+static void addMoves(ScoredMoveList *moves, int from, Bitboard targets) {
+    while (targets) {
+        int to = LSB_INDEX(targets);
+        POP_LSB(targets);
+        addMove(moves, from, to, 0);
+    }
+}
+
+// Append pawn moves to every target, expanding promotions into the given piece range
+static void addPawnMoves(ScoredMoveList *moves, int from, Bitboard targets, Bitboard promotionRank,
+                         int firstPromotion, int lastPromotion) {
+    while (targets) {
+        int to = LSB_INDEX(targets);
+        POP_LSB(targets);
+        
+        if (SQUARE_BB(to) & promotionRank) {
+            for (int p = firstPromotion; p <= lastPromotion; p++) {
+                addMove(moves, from, to, p);
             }
+        } else {
+            addMove(moves, from, to, 0);
+        }
+    }
+}
+
+// All pieces of a color attacking a square for a given occupancy
+Bitboard attackersTo(const GameState *state, int square, Color color, Bitboard occupied) {
+    const Bitboard *pieces = state->pieceBB[color];
+    
+    return (pawnAttackTable[!color][square] & pieces[PAWN]) |
+           (knightAttackTable[square] & pieces[KNIGHT]) |
+           (kingAttackTable[square] & pieces[KING]) |
+           (bishopAttacksFast(square, occupied) & (pieces[BISHOP] | pieces[QUEEN])) |
+           (rookAttacksFast(square, occupied) & (pieces[ROOK] | pieces[QUEEN]));
+}
+
+// Own pieces that are the only blocker between the king and an enemy slider
+static Bitboard pinnedPieces(const GameState *state, int kingSquare, Color us) {
+    const Bitboard *enemy = state->pieceBB[!us];
+    Bitboard snipers = (rookAttacksFast(kingSquare, 0) & (enemy[ROOK] | enemy[QUEEN])) |
+                       (bishopAttacksFast(kingSquare, 0) & (enemy[BISHOP] | enemy[QUEEN]));
+    Bitboard pinned = 0;
+    
+    while (snipers) {
+        int sniper = LSB_INDEX(snipers);
+        POP_LSB(snipers);
+        
+        Bitboard blockers = betweenTable[kingSquare][sniper] & state->occupiedBB;
+        if (blockers && !(blockers & (blockers - 1))) {
+            pinned |= blockers & state->colorBB[us];
         }
     }
+    
+    return pinned;
+}
+
+// Non-king moves out of a single check: capture the checker or block its ray.
+// Works backwards from the few target squares instead of trying every piece;
+// pinned pieces can never help, since their pin line only meets the check ray at the king.
+static void generateEvasions(const GameState *state, ScoredMoveList *moves, MoveGenType type,
+                             int kingSquare, int checkerSquare, Bitboard pinned) {
+    Color us = state->turn;
+    const Bitboard *pieces = state->pieceBB[us];
+    Bitboard occupied = state->occupiedBB;
+    Bitboard movable = state->colorBB[us] & ~pieces[KING] & ~pinned;
+    Bitboard promotionRank = RANK_BB((us == WHITE) ? 7 : 0);
+    int direction = (us == WHITE) ? 1 : -1;
+    int doubleStepRow = (us == WHITE) ? 3 : 4;
+    
+    // Capture the checker
+    if (type != GEN_QUIETS) {
+        Bitboard capturers = attackersTo(state, checkerSquare, us, occupied) & movable;
+        while (capturers) {
+            int from = LSB_INDEX(capturers);
+            POP_LSB(capturers);
+            
+            if (pieces[PAWN] & SQUARE_BB(from)) {
+                addPawnMoves(moves, from, SQUARE_BB(checkerSquare), promotionRank, KNIGHT, QUEEN);
+            } else {
+                addMove(moves, from, checkerSquare, 0);
+            }
+        }
+        
+        // En passant, typically taking the pawn that just gave check
+        int epRow = (us == WHITE) ? 4 : 3;
+        if (state->enPassantCol >= 0) {
+            int to = SQUARE_INDEX(epRow + direction, state->enPassantCol);
+            int captured = SQUARE_INDEX(epRow, state->enPassantCol);
+            Bitboard epPawns = pawnAttackTable[!us][to] & pieces[PAWN] & RANK_BB(epRow);
+            
+            while (epPawns && !(occupied & SQUARE_BB(to))) {
+                int from = LSB_INDEX(epPawns);
+                POP_LSB(epPawns);
+                if (!moveLeavesKingInCheck(state, from, to, PAWN, captured, 0)) {
+                    addMove(moves, from, to, 0);
+                }
+            }
+        }
+    }
+    
+    // Block the checking ray
+    Bitboard blocks = betweenTable[kingSquare][checkerSquare];
+    while (blocks) {
+        int to = LSB_INDEX(blocks);
+        POP_LSB(blocks);
+        
+        if (type != GEN_CAPTURES) {
+            Bitboard blockers = ((knightAttackTable[to] & pieces[KNIGHT]) |
+                                 (bishopAttacksFast(to, occupied) & (pieces[BISHOP] | pieces[QUEEN])) |
+                                 (rookAttacksFast(to, occupied) & (pieces[ROOK] | pieces[QUEEN]))) & movable;
+            while (blockers) {
+                int from = LSB_INDEX(blockers);
+                POP_LSB(blockers);
+                addMove(moves, from, to, 0);
+            }
+        }
+        
+        // Pawn pushes onto the ray: single step, or double step through an empty square
+        int toRow = SQUARE_ROW(to);
+        int from = -1;
+        if (toRow - direction >= 0 && toRow - direction < BOARD_SIZE &&
+            (SQUARE_BB(to - direction * BOARD_SIZE) & pieces[PAWN] & movable)) {
+            from = to - direction * BOARD_SIZE;
+        } else if (toRow == doubleStepRow && !(occupied & SQUARE_BB(to - direction * BOARD_SIZE)) &&
+                   (SQUARE_BB(to - 2 * direction * BOARD_SIZE) & pieces[PAWN] & movable)) {
+            from = to - 2 * direction * BOARD_SIZE;
+        }
+        
+        if (from < 0) {
+            continue;
+        }
+        
+        if (SQUARE_BB(to) & promotionRank) {
+            if (type == GEN_ALL) {
+                addPawnMoves(moves, from, SQUARE_BB(to), promotionRank, KNIGHT, QUEEN);
+            } else if (type == GEN_CAPTURES) {
+                addPawnMoves(moves, from, SQUARE_BB(to), promotionRank, QUEEN, QUEEN);
+            } else {
+                addPawnMoves(moves, from, SQUARE_BB(to), promotionRank, KNIGHT, ROOK);
+            }
+        } else if (type != GEN_CAPTURES) {
+            addMove(moves, from, to, 0);
+        }
+    }
+}
+
+// Generate the legal moves of one kind for the current player, packed and unscored.
+// Checkers and pinned pieces are worked out once, so every move emitted is legal
+// without replaying it; only king steps and en passant need an attack test.
+// GEN_CAPTURES covers captures, en passant and queen promotions, GEN_QUIETS the rest.
+void generatePackedMoves(const GameState *state, ScoredMoveList *moves, MoveGenType type) {
+    PROFILE_SCOPE(PROF_GENERATE_PACKED_MOVES);
+    
+    moves->count = 0;
+    
+    Color us = state->turn;
+    Color them = !us;
+    int kingSquare = state->kingSquare[us];
+    
+    if (kingSquare < 0) {
+        // Without a king there are no pins or checks to work from
+        MoveList all;
+        generateMovesReference(state, &all);
+        for (int i = 0; i < all.count; i++) {
+            Move move = all.moves[i];
+            bool isTactical = getPiece(state, move.toRow, move.toCol) != EMPTY ||
+                              (GET_PIECE_TYPE(getPiece(state, move.fromRow, move.fromCol)) == PAWN &&
+                               move.fromCol != move.toCol) ||
+                              move.promotionPiece == QUEEN;
+            if (type == GEN_ALL || (type == GEN_CAPTURES) == isTactical) {
+                moves->moves[moves->count++] = packMove(move);
+            }
+        }
+        return;
+    }
+    
+    Bitboard kingBB = SQUARE_BB(kingSquare);
+    Bitboard own = state->colorBB[us];
+    Bitboard enemy = state->colorBB[them];
+    Bitboard occupied = state->occupiedBB;
+    Bitboard checkers = attackersTo(state, kingSquare, them, occupied);
+    Bitboard targetMask = (type == GEN_CAPTURES) ? enemy : (type == GEN_QUIETS) ? ~occupied : ~own;
+    
+    // King moves: the destination must be safe once the king has left its square
+    Bitboard targets = kingAttackTable[kingSquare] & targetMask;
+    while (targets) {
+        int to = LSB_INDEX(targets);
+        POP_LSB(targets);
+        if (!isSquareAttackedBB(state, to, them, occupied ^ kingBB, SQUARE_BB(to))) {
+            addMove(moves, kingSquare, to, 0);
+        }
+    }
+    
+    // In double check only the king can move
+    if (checkers & (checkers - 1)) {
+        return;
+    }
+    
+    Bitboard pinned = pinnedPieces(state, kingSquare, us);
+    
+    // In single check only captures of the checker and interpositions remain
+    if (checkers) {
+        generateEvasions(state, moves, type, kingSquare, LSB_INDEX(checkers), pinned);
+        return;
+    }
+    
+    // Not in check from here on. Pinned pieces stay on the line through their king.
+    
+    // Pawns
+    int direction = (us == WHITE) ? 1 : -1;
+    int startRow = (us == WHITE) ? 1 : 6;
+    int epRow = (us == WHITE) ? 4 : 3;
+    Bitboard promotionRank = RANK_BB((us == WHITE) ? 7 : 0);
+    Bitboard pawns = state->pieceBB[us][PAWN];
+    
+    while (pawns) {
+        int from = LSB_INDEX(pawns);
+        POP_LSB(pawns);
+        
+        int fromRow = SQUARE_ROW(from);
+        int oneStep = from + direction * BOARD_SIZE;
+        Bitboard captures = pawnAttackTable[us][from] & enemy;
+        Bitboard pushes = 0;
+        
+        if (!(occupied & SQUARE_BB(oneStep))) {
+            pushes |= SQUARE_BB(oneStep);
+            
+            int twoStep = oneStep + direction * BOARD_SIZE;
+            if (fromRow == startRow && !(occupied & SQUARE_BB(twoStep))) {
+                pushes |= SQUARE_BB(twoStep);
+            }
+        }
+        
+        if (pinned & SQUARE_BB(from)) {
+            captures &= lineTable[kingSquare][from];
+            pushes &= lineTable[kingSquare][from];
+        }
+        
+        // Queen promotions count as tactical moves, under-promotions by pushing as quiet ones
+        if (type == GEN_ALL) {
+            addPawnMoves(moves, from, captures | pushes, promotionRank, KNIGHT, QUEEN);
+        } else if (type == GEN_CAPTURES) {
+            addPawnMoves(moves, from, captures, promotionRank, KNIGHT, QUEEN);
+            addPawnMoves(moves, from, pushes & promotionRank, promotionRank, QUEEN, QUEEN);
+        } else {
+            addPawnMoves(moves, from, pushes, promotionRank, KNIGHT, ROOK);
+        }
+        
+        // En passant removes a pawn off the capture line, so test it directly
+        if (state->enPassantCol >= 0 && fromRow == epRow && type != GEN_QUIETS) {
+            int to = SQUARE_INDEX(epRow + direction, state->enPassantCol);
+            if ((pawnAttackTable[us][from] & SQUARE_BB(to)) && !(occupied & SQUARE_BB(to)) &&
+                !moveLeavesKingInCheck(state, from, to, PAWN, SQUARE_INDEX(epRow, state->enPassantCol), 0)) {
+                addMove(moves, from, to, 0);
+            }
+        }
+    }
+    
+    // Knights, bishops, rooks and queens
+    Bitboard pieces = own & ~state->pieceBB[us][PAWN] & ~kingBB;
+    while (pieces) {
+        int from = LSB_INDEX(pieces);
+        POP_LSB(pieces);
+        
+        switch (GET_PIECE_TYPE(state->board[SQUARE_ROW(from)][SQUARE_COL(from)])) {
+            case KNIGHT:
+                targets = knightAttackTable[from];
+                break;
+            case BISHOP:
+                targets = bishopAttacksFast(from, occupied);
+                break;
+            case ROOK:
+                targets = rookAttacksFast(from, occupied);
+                break;
+            case QUEEN:
+                targets = bishopAttacksFast(from, occupied) | rookAttacksFast(from, occupied);
+                break;
+            default:
+                targets = 0;
+                break;
+        }
+        
+        targets &= targetMask;
+        if (pinned & SQUARE_BB(from)) {
+            targets &= lineTable[kingSquare][from];
+        }
+        addMoves(moves, from, targets);
+    }
+    
+    // Castling: not out of check, through or into an attacked square
+    int row = (us == WHITE) ? 0 : 7;
+    if (kingSquare == SQUARE_INDEX(row, 4) && type != GEN_CAPTURES) {
+        Bitboard rooks = state->pieceBB[us][ROOK];
+        Bitboard withoutKing = occupied ^ kingBB;
+        
+        // Kingside castling
+        if (state->castlingRights[us][1] && (rooks & SQUARE_BB(SQUARE_INDEX(row, 7))) &&
+            !(occupied & (SQUARE_BB(SQUARE_INDEX(row, 5)) | SQUARE_BB(SQUARE_INDEX(row, 6)))) &&
+            !isSquareAttackedBB(state, SQUARE_INDEX(row, 5), them, withoutKing, 0) &&
+            !isSquareAttackedBB(state, SQUARE_INDEX(row, 6), them, withoutKing, 0)) {
+            addMove(moves, kingSquare, SQUARE_INDEX(row, 6), 0);
+        }
+        
+        // Queenside castling
+        if (state->castlingRights[us][0] && (rooks & SQUARE_BB(SQUARE_INDEX(row, 0))) &&
+            !(occupied & (SQUARE_BB(SQUARE_INDEX(row, 1)) | SQUARE_BB(SQUARE_INDEX(row, 2)) |
+                          SQUARE_BB(SQUARE_INDEX(row, 3)))) &&
+            !isSquareAttackedBB(state, SQUARE_INDEX(row, 3), them, withoutKing, 0) &&
+            !isSquareAttackedBB(state, SQUARE_INDEX(row, 2), them, withoutKing, 0)) {
+            addMove(moves, kingSquare, SQUARE_INDEX(row, 2), 0);
+        }
+    }
+}
+
+// Generate the legal moves of one kind as full Move structs
+void generateMovesOfType(const GameState *state, MoveList *moves, MoveGenType type) {
+    ScoredMoveList packed;
+    generatePackedMoves(state, &packed, type);
+    
+    for (int i = 0; i < packed.count; i++) {
+        moves->moves[i] = unpackMove(packed.moves[i]);
+    }
+    moves->count = packed.count;
+}
+
+// Generate all legal moves for the current player
+void generateMoves(const GameState *state, MoveList *moves) {
+    PROFILE_SCOPE(PROF_GENERATE_MOVES);
+    generateMovesOfType(state, moves, GEN_ALL);
+}
+
+// Generate only the tactical moves (captures, en passant, queen promotions) for quiescence
+void generateCaptures(const GameState *state, MoveList *moves) {
+    generateMovesOfType(state, moves, GEN_CAPTURES);
 }
 
 // Check for checkmate (king in check with no legal moves)
 bool isCheckmate(const GameState *state) {
+    PROFILE_SCOPE(PROF_IS_CHECKMATE);
+    
     if (!isInCheck(state, state->turn)) {
         return false;
     }
     
-    MoveList moves;
-    generateMoves(state, &moves);
+    ScoredMoveList moves;
+    generatePackedMoves(state, &moves, GEN_ALL);
     
     return moves.count == 0;
 }
 
 // Check for stalemate (not in check but no legal moves)
 bool isStalemate(const GameState *state) {
+    PROFILE_SCOPE(PROF_IS_STALEMATE);
+    
     if (isInCheck(state, state->turn)) {
         return false;
     }
     
-    MoveList moves;
-    generateMoves(state, &moves);
+    ScoredMoveList moves;
+    generatePackedMoves(state, &moves, GEN_ALL);
     
     return moves.count == 0;
 }
 
 // Check for various draw conditions
 bool isDraw(const GameState *state) {
+    PROFILE_SCOPE(PROF_IS_DRAW);
     return isStalemate(state) || isFiftyMoveDraw(state) || isInsufficientMaterial(state);
 }
 
@@ -702,75 +1209,25 @@ bool isFiftyMoveDraw(const GameState *state) {
 
 // Check for insufficient material draw
 bool isInsufficientMaterial(const GameState *state) {
-    int pieceCounts[2][7] = {0}; // [color][piece type]
+    const int (*pieceCounts)[7] = state->pieceCount; // [color][piece type]
     
-    // Count all pieces on the board
-    for (int row = 0; row < BOARD_SIZE; row++) {
-        for (int col = 0; col < BOARD_SIZE; col++) {
-            Piece piece = getPiece(state, row, col);
-            if (piece != EMPTY) {
-                int pieceType = GET_PIECE_TYPE(piece);
-                int color = GET_PIECE_COLOR(piece);
-                pieceCounts[color][pieceType]++;
-            }
-        }
+    // Any pawn, rook or queen can still lead to mate
+    if (pieceCounts[WHITE][PAWN] + pieceCounts[BLACK][PAWN] + pieceCounts[WHITE][ROOK] +
+        pieceCounts[BLACK][ROOK] + pieceCounts[WHITE][QUEEN] + pieceCounts[BLACK][QUEEN] > 0) {
+        return false;
     }
     
-    // King vs King
-    if (pieceCounts[WHITE][PAWN] == 0 && pieceCounts[BLACK][PAWN] == 0 &&
-        pieceCounts[WHITE][ROOK] == 0 && pieceCounts[BLACK][ROOK] == 0 &&
-        pieceCounts[WHITE][QUEEN] == 0 && pieceCounts[BLACK][QUEEN] == 0) {
-        
-        // King vs King
-        if (pieceCounts[WHITE][BISHOP] == 0 && pieceCounts[BLACK][BISHOP] == 0 &&
-            pieceCounts[WHITE][KNIGHT] == 0 && pieceCounts[BLACK][KNIGHT] == 0) {
-            return true;
-        }
-        
-        // King + Bishop vs King
-        if ((pieceCounts[WHITE][BISHOP] == 1 && pieceCounts[BLACK][BISHOP] == 0 && 
-             pieceCounts[WHITE][KNIGHT] == 0 && pieceCounts[BLACK][KNIGHT] == 0) ||
-            (pieceCounts[BLACK][BISHOP] == 1 && pieceCounts[WHITE][BISHOP] == 0 && 
-             pieceCounts[BLACK][KNIGHT] == 0 && pieceCounts[WHITE][KNIGHT] == 0)) {
-            return true;
-        }
-        
-        // King + Knight vs King
-        if ((pieceCounts[WHITE][KNIGHT] == 1 && pieceCounts[BLACK][KNIGHT] == 0 && 
-             pieceCounts[WHITE][BISHOP] == 0 && pieceCounts[BLACK][BISHOP] == 0) ||
-            (pieceCounts[BLACK][KNIGHT] == 1 && pieceCounts[WHITE][KNIGHT] == 0 && 
-             pieceCounts[BLACK][BISHOP] == 0 && pieceCounts[WHITE][BISHOP] == 0)) {
-            return true;
-        }
-        
-        // King + Bishop vs King + Bishop (same color bishops)
-        if (pieceCounts[WHITE][BISHOP] == 1 && pieceCounts[BLACK][BISHOP] == 1 &&
-            pieceCounts[WHITE][KNIGHT] == 0 && pieceCounts[BLACK][KNIGHT] == 0) {
-            // Check if bishops are on the same colored squares
-            int whiteBishopColor = -1;
-            int blackBishopColor = -1;
-            
-            for (int row = 0; row < BOARD_SIZE; row++) {
-                for (int col = 0; col < BOARD_SIZE; col++) {
-                    Piece piece = getPiece(state, row, col);
-                    if (GET_PIECE_TYPE(piece) == BISHOP) {
-                        int squareColor = (row + col) % 2;
-                        if (GET_PIECE_COLOR(piece) == WHITE) {
-                            whiteBishopColor = squareColor;
-                        } else {
-                            blackBishopColor = squareColor;
-                        }
-                    }
-                }
-            }
-            
-            if (whiteBishopColor == blackBishopColor) {
-                return true;
-            }
-        }
+    int knights = pieceCounts[WHITE][KNIGHT] + pieceCounts[BLACK][KNIGHT];
+    int bishops = pieceCounts[WHITE][BISHOP] + pieceCounts[BLACK][BISHOP];
+    
+    // King vs King, King + Bishop vs King, King + Knight vs King
+    if (knights + bishops <= 1) {
+        return true;
     }
     
-    return false;
+    // King + Bishop vs King + Bishop (same color bishops)
+    return knights == 0 && pieceCounts[WHITE][BISHOP] == 1 && pieceCounts[BLACK][BISHOP] == 1 &&
+           state->bishopSquareCount[WHITE][1] == state->bishopSquareCount[BLACK][1];
 }
 
 // Check for threefold repetition
@@ -782,42 +1239,11 @@ bool isThreefoldRepetition(const GameHistory *history) {
     const GameState *currentState = &history->history[history->historyIndex].state;
     int repetitionCount = 1;
     
-    // Check back through history for identical positions
-    for (int i = history->historyIndex - 2; i >= 0; i -= 2) {
-        const GameState *pastState = &history->history[i].state;
-        
-        bool identical = true;
-        
-        // Compare board positions
-        for (int row = 0; row < BOARD_SIZE; row++) {
-            for (int col = 0; col < BOARD_SIZE; col++) {
-                if (pastState->board[row][col] != currentState->board[row][col]) {
-                    identical = false;
-                    break;
-                }
-            }
-            if (!identical) break;
-        }
-        
-        // Compare castling rights
-        if (identical) {
-            for (int color = 0; color < 2; color++) {
-                for (int side = 0; side < 2; side++) {
-                    if (pastState->castlingRights[color][side] != currentState->castlingRights[color][side]) {
-                        identical = false;
-                        break;
-                    }
-                }
-                if (!identical) break;
-            }
-        }
-        
-        // Compare en passant possibilities
-        if (identical && pastState->enPassantCol != currentState->enPassantCol) {
-            identical = false;
-        }
-        
-        if (identical) {
+    // Check back through history for identical positions with the same side to move,
+    // no further than the last capture or pawn move
+    int oldest = history->historyIndex - currentState->halfMoveClock;
+    for (int i = history->historyIndex - 2; i >= 0 && i >= oldest; i -= 2) {
+        if (history->history[i].state.hashKey == currentState->hashKey) {
             repetitionCount++;
             if (repetitionCount >= 3) {
                 return true;
@@ -828,8 +1254,55 @@ bool isThreefoldRepetition(const GameHistory *history) {
     return false;
 }
 
+// Check whether the current position already occurred at least the given number of times.
+// Only positions since the last capture or pawn move can repeat, and only every second one
+// has the same side to move, so this looks at a handful of keys at most.
+bool isRepetition(const KeyHistory *keys, const GameState *state, int times) {
+    int oldest = keys->count - state->halfMoveClock;
+    
+    for (int i = keys->count - 4; i >= 0 && i >= oldest; i -= 2) {
+        if (keys->keys[i] == state->hashKey && --times == 0) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// Check whether a search should score the current position as a draw by repetition. One
+// earlier occurrence within the search line is enough, since the side that allowed it can
+// repeat it again; positions from the game before the root (keys below rootCount) only count
+// when they make a threefold repetition.
+bool isSearchRepetition(const KeyHistory *keys, const GameState *state) {
+    int oldest = keys->count - state->halfMoveClock;
+    int gameOccurrences = 0;
+    
+    for (int i = keys->count - 4; i >= 0 && i >= oldest; i -= 2) {
+        if (keys->keys[i] == state->hashKey && (i >= keys->rootCount || ++gameOccurrences == 2)) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// Gather the keys of the positions played so far, before the current one. They all
+// precede the search root.
+void collectHistoryKeys(const GameHistory *history, KeyHistory *keys) {
+    keys->count = 0;
+    
+    if (history && history->historyCount > 0) {
+        for (int i = 0; i <= history->historyIndex && keys->count < MAX_KEY_HISTORY; i++) {
+            keys->keys[keys->count++] = history->history[i].state.hashKey;
+        }
+    }
+    keys->rootCount = keys->count;
+}
+
 // Execute a move and update the game state
 bool makeMove(GameState *state, Move move, GameHistory *history) {
+    PROFILE_SCOPE(PROF_MAKE_MOVE);
+    
     if (!isValidMove(state, move)) {
         return false;
     }
@@ -839,8 +1312,12 @@ bool makeMove(GameState *state, Move move, GameHistory *history) {
     int toRow = move.toRow;
     int toCol = move.toCol;
     
-    // Save current state for undo
-    MoveHistory *hist = &history->history[history->historyCount];
+    // Save current state for undo (a new move discards any undone moves after it)
+    int slot = (history->historyCount == 0) ? 0 : history->historyIndex + 1;
+    if (slot >= (int)(sizeof(history->history) / sizeof(history->history[0]))) {
+        return false;
+    }
+    MoveHistory *hist = &history->history[slot];
     hist->state = *state;
     hist->lastMove = move;
     hist->capturedPiece = getPiece(state, toRow, toCol);
@@ -850,10 +1327,14 @@ bool makeMove(GameState *state, Move move, GameHistory *history) {
     hist->oldEnPassantCol = state->enPassantCol;
     hist->oldHalfMoveClock = state->halfMoveClock;
     memcpy(hist->oldCastlingRights, state->castlingRights, sizeof(state->castlingRights));
+    hist->oldPgnLength = history->pgnLength;
     
     Piece movingPiece = getPiece(state, fromRow, fromCol);
     int pieceType = GET_PIECE_TYPE(movingPiece);
     
+    // Take the old castling rights and en passant file out of the hash key
+    state->hashKey ^= rightsKey(state->castlingRights, state->enPassantCol);
+    
     // Reset en passant
     state->enPassantCol = -1;
     
@@ -935,6 +1416,7 @@ bool makeMove(GameState *state, Move move, GameHistory *history) {
     
     // Update turn
     state->turn = !state->turn;
+    state->hashKey ^= rightsKey(state->castlingRights, state->enPassantCol) ^ zobristBlackToMove;
     
     // Update fullmove counter
     if (state->turn == WHITE) {
@@ -942,8 +1424,8 @@ bool makeMove(GameState *state, Move move, GameHistory *history) {
     }
     
     // Update history
-    history->historyCount++;
-    history->historyIndex = history->historyCount - 1;
+    history->historyIndex = slot;
+    history->historyCount = slot + 1;
     
     // Convert move to algebraic notation and add to PGN
     addMoveToPGN(state, move, history);
@@ -953,7 +1435,7 @@ bool makeMove(GameState *state, Move move, GameHistory *history) {
 
 // Undo the last move
 void undoMove(GameState *state, GameHistory *history) {
-    if (history->historyIndex < 0) {
+    if (history->historyCount == 0 || history->historyIndex < 0) {
         return; // Nothing to undo
     }
     
@@ -999,12 +1481,17 @@ void undoMove(GameState *state, GameHistory *history) {
     
     // Update turn
     state->turn = (state->turn == WHITE) ? BLACK : WHITE;
+    state->hashKey = hist->state.hashKey;
     
     // Update fullmove counter
     if (state->turn == BLACK) {
         state->fullMoveNumber--;
     }
     
+    // Drop the move from the PGN record
+    history->pgnLength = hist->oldPgnLength;
+    history->pgn[history->pgnLength] = '\0';
+    
     history->historyIndex--;
 }
 
@@ -1014,16 +1501,146 @@ void redoMove(GameState *state, GameHistory *history) {
         return; // Nothing to redo
     }
     
-    history->historyIndex++;
-    MoveHistory *hist = &history->history[history->historyIndex];
+    int historyCount = history->historyCount;
+    MoveHistory *hist = &history->history[history->historyIndex + 1];
     *state = hist->state;
     
     // Execute the move again
     makeMove(state, hist->lastMove, history);
     
-    // Fix the history index which was incremented again by makeMove
-    history->historyCount--;
-    history->historyIndex = history->historyCount - 1;
+    // makeMove truncated the history at the redone move; keep the remaining redo entries
+    history->historyCount = historyCount;
+}
+
+// Make a legal move for the search: no validation, history or PGN, just the undo record.
+// The state changes exactly as with makeMove.
+void doMove(GameState *state, PackedMove move, MoveUndo *undo) {
+    PROFILE_SCOPE(PROF_DO_MOVE);
+    
+    int from = PACKED_FROM(move);
+    int to = PACKED_TO(move);
+    int fromRow = SQUARE_ROW(from);
+    int fromCol = SQUARE_COL(from);
+    int toRow = SQUARE_ROW(to);
+    int toCol = SQUARE_COL(to);
+    Color us = state->turn;
+    Piece movingPiece = state->board[fromRow][fromCol];
+    Piece capturedPiece = state->board[toRow][toCol];
+    int pieceType = GET_PIECE_TYPE(movingPiece);
+    
+    undo->move = move;
+    undo->movedPiece = movingPiece;
+    undo->enPassantCol = state->enPassantCol;
+    undo->halfMoveClock = state->halfMoveClock;
+    undo->hashKey = state->hashKey;
+    memcpy(undo->castlingRights, state->castlingRights, sizeof(state->castlingRights));
+    
+    state->hashKey ^= rightsKey(state->castlingRights, state->enPassantCol);
+    state->enPassantCol = -1;
+    state->halfMoveClock = (pieceType == PAWN || capturedPiece != EMPTY) ? 0 : state->halfMoveClock + 1;
+    
+    if (pieceType == PAWN) {
+        if (abs(toRow - fromRow) == 2) {
+            state->enPassantCol = fromCol;
+        } else if (fromCol != toCol && capturedPiece == EMPTY) {
+            // En passant: the captured pawn sits beside the moving one
+            capturedPiece = state->board[fromRow][toCol];
+            setPiece(state, fromRow, toCol, EMPTY);
+        }
+        
+        if (toRow == 0 || toRow == 7) {
+            movingPiece = CREATE_PIECE(PACKED_PROMOTION(move), us);
+        }
+    } else if (pieceType == KING) {
+        if (abs(toCol - fromCol) == 2) {
+            int rookFrom = (toCol == 6) ? 7 : 0;
+            int rookTo = (toCol == 6) ? 5 : 3;
+            setPiece(state, fromRow, rookTo, state->board[fromRow][rookFrom]);
+            setPiece(state, fromRow, rookFrom, EMPTY);
+        }
+        state->castlingRights[us][0] = false;
+        state->castlingRights[us][1] = false;
+    } else if (pieceType == ROOK && (fromRow == 0 || fromRow == 7) && (fromCol == 0 || fromCol == 7)) {
+        state->castlingRights[fromRow == 7][fromCol == 7] = false;
+    }
+    
+    // A rook captured in its corner takes its castling right with it
+    if (GET_PIECE_TYPE(capturedPiece) == ROOK && (toRow == 0 || toRow == 7) && (toCol == 0 || toCol == 7)) {
+        state->castlingRights[toRow == 7][toCol == 7] = false;
+    }
+    undo->capturedPiece = capturedPiece;
+    
+    setPiece(state, fromRow, fromCol, EMPTY);
+    setPiece(state, toRow, toCol, SET_PIECE_MOVED(movingPiece));
+    
+    state->turn = !us;
+    state->hashKey ^= rightsKey(state->castlingRights, state->enPassantCol) ^ zobristBlackToMove;
+    if (state->turn == WHITE) {
+        state->fullMoveNumber++;
+    }
+}
+
+// Take back a move made with doMove
+void unmakeMove(GameState *state, const MoveUndo *undo) {
+    PROFILE_SCOPE(PROF_UNMAKE_MOVE);
+    
+    int from = PACKED_FROM(undo->move);
+    int to = PACKED_TO(undo->move);
+    int fromRow = SQUARE_ROW(from);
+    int fromCol = SQUARE_COL(from);
+    int toRow = SQUARE_ROW(to);
+    int toCol = SQUARE_COL(to);
+    int pieceType = GET_PIECE_TYPE(undo->movedPiece);
+    
+    if (state->turn == WHITE) {
+        state->fullMoveNumber--;
+    }
+    state->turn = !state->turn;
+    
+    setPiece(state, fromRow, fromCol, undo->movedPiece);
+    
+    // A diagonal pawn move onto the en passant square can only have been en passant
+    if (pieceType == PAWN && fromCol != toCol && undo->enPassantCol == toCol &&
+        toRow == ((state->turn == WHITE) ? 5 : 2)) {
+        setPiece(state, toRow, toCol, EMPTY);
+        setPiece(state, fromRow, toCol, undo->capturedPiece);
+    } else {
+        setPiece(state, toRow, toCol, undo->capturedPiece);
+    }
+    
+    if (pieceType == KING && abs(toCol - fromCol) == 2) {
+        int rookFrom = (toCol == 6) ? 7 : 0;
+        int rookTo = (toCol == 6) ? 5 : 3;
+        setPiece(state, fromRow, rookFrom, state->board[fromRow][rookTo]);
+        setPiece(state, fromRow, rookTo, EMPTY);
+    }
+    
+    state->enPassantCol = undo->enPassantCol;
+    state->halfMoveClock = undo->halfMoveClock;
+    state->hashKey = undo->hashKey;
+    memcpy(state->castlingRights, undo->castlingRights, sizeof(state->castlingRights));
+}
+
+// Convert a move to the packed 16-bit form (PACKED_MOVE_NONE for an empty move)
+PackedMove packMove(Move move) {
+    if (move.fromRow < 0) {
+        return PACKED_MOVE_NONE;
+    }
+    return PACK_MOVE(SQUARE_INDEX(move.fromRow, move.fromCol), SQUARE_INDEX(move.toRow, move.toCol),
+                     move.promotionPiece);
+}
+
+// Expand a packed move (PACKED_MOVE_NONE gives the empty move, fromRow -1)
+Move unpackMove(PackedMove move) {
+    if (move == PACKED_MOVE_NONE) {
+        Move none = {-1, -1, -1, -1, 0};
+        return none;
+    }
+    
+    int from = PACKED_FROM(move);
+    int to = PACKED_TO(move);
+    Move unpacked = {SQUARE_ROW(from), SQUARE_COL(from), SQUARE_ROW(to), SQUARE_COL(to), PACKED_PROMOTION(move)};
+    return unpacked;
 }
 
 // Convert algebraic notation (e.g., "e2-e4") to a Move struct
@@ -1076,6 +1693,34 @@ void moveToAlgebraic(const GameState *state, Move move, char *algebraic) {
     }
 }
 
+// Convert a Move to compact coordinate notation (e.g., "e2e4", "e7e8q")
+void moveToLongAlgebraic(Move move, char *text) {
+    text[0] = 'a' + move.fromCol;
+    text[1] = '1' + move.fromRow;
+    text[2] = 'a' + move.toCol;
+    text[3] = '1' + move.toRow;
+    
+    if (move.promotionPiece > 0) {
+        text[4] = " pnbrqk"[move.promotionPiece];
+        text[5] = '\0';
+    } else {
+        text[4] = '\0';
+    }
+}
+
+// Nanoseconds on a monotonic clock: only differences are meaningful, and unlike the time of
+// day it never jumps when the system clock is set
+uint64_t monotonicNanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Monotonic time in seconds, for the search's time budget and the tools' timings
+double nowSeconds(void) {
+    return monotonicNanoseconds() / 1e9;
+}
+
 // Add a move to the PGN record
 void addMoveToPGN(GameState *state, Move move, GameHistory *history) {
     char algebraic[10];
@@ -1088,9 +1733,13 @@ void addMoveToPGN(GameState *state, Move move, GameHistory *history) {
         sprintf(pgnMove, "%s ", algebraic);
     }
     
-    // Append to PGN
-    strcat(history->pgn + history->pgnLength, pgnMove);
-    history->pgnLength += strlen(pgnMove);
+    // Append to PGN (moves that no longer fit are left out of the record)
+    int moveLength = strlen(pgnMove);
+    if (history->pgnLength + moveLength >= (int)sizeof(history->pgn)) {
+        return;
+    }
+    memcpy(history->pgn + history->pgnLength, pgnMove, moveLength + 1);
+    history->pgnLength += moveLength;
 }
 
 // Save the game to a file in PGN format
@@ -1191,6 +1840,90 @@ bool loadGame(GameState *state, GameHistory *history, const char *filename) {
     return true;
 }
 
+// Set up a position from Forsyth-Edwards Notation. The move counters may be omitted.
+// Returns false (leaving the state undefined) if the text is malformed.
+bool loadFEN(GameState *state, const char *fen) {
+    initializeGame(state);
+    for (int row = 0; row < BOARD_SIZE; row++) {
+        for (int col = 0; col < BOARD_SIZE; col++) {
+            setPiece(state, row, col, EMPTY);
+        }
+    }
+    
+    // Piece placement, rank 8 first
+    const char *p = fen;
+    int row = BOARD_SIZE - 1;
+    int col = 0;
+    for (; *p && *p != ' '; p++) {
+        if (*p == '/') {
+            if (col != BOARD_SIZE || row == 0) return false;
+            row--;
+            col = 0;
+        } else if (*p >= '1' && *p <= '8') {
+            col += *p - '0';
+            if (col > BOARD_SIZE) return false;
+        } else {
+            const char *types = strchr("pnbrqk", tolower((unsigned char)*p));
+            if (!types || col >= BOARD_SIZE) return false;
+            Color color = isupper((unsigned char)*p) ? WHITE : BLACK;
+            setPiece(state, row, col++, CREATE_PIECE(PAWN + (int)(types - "pnbrqk"), color));
+        }
+    }
+    if (row != 0 || col != BOARD_SIZE || *p != ' ') return false;
+    
+    // Side to move
+    p++;
+    if (*p == 'w') {
+        state->turn = WHITE;
+    } else if (*p == 'b') {
+        state->turn = BLACK;
+    } else {
+        return false;
+    }
+    p++;
+    if (*p != ' ') return false;
+    p++;
+    
+    // Castling rights
+    memset(state->castlingRights, 0, sizeof(state->castlingRights));
+    for (; *p && *p != ' '; p++) {
+        switch (*p) {
+            case 'K': state->castlingRights[WHITE][1] = true; break;
+            case 'Q': state->castlingRights[WHITE][0] = true; break;
+            case 'k': state->castlingRights[BLACK][1] = true; break;
+            case 'q': state->castlingRights[BLACK][0] = true; break;
+            case '-': break;
+            default: return false;
+        }
+    }
+    if (*p != ' ') return false;
+    p++;
+    
+    // En passant target square (only the file is kept)
+    state->enPassantCol = -1;
+    if (*p >= 'a' && *p <= 'h' && (p[1] == '3' || p[1] == '6')) {
+        state->enPassantCol = *p - 'a';
+        p += 2;
+    } else if (*p == '-') {
+        p++;
+    } else {
+        return false;
+    }
+    
+    // Optional move counters
+    state->halfMoveClock = 0;
+    state->fullMoveNumber = 1;
+    if (*p == ' ') {
+        int halfMoves, fullMoves;
+        int fields = sscanf(p, "%d %d", &halfMoves, &fullMoves);
+        if (fields >= 1) state->halfMoveClock = halfMoves;
+        if (fields >= 2) state->fullMoveNumber = fullMoves;
+    }
+    
+    state->hashKey = computeHashKey(state);
+    return true;
+}
+
 // Utility function to get a character representing a piece
 char getPieceChar(Piece piece) {
     if (piece == EMPTY) {
@@ -1225,4 +1958,41 @@ void printBoard(const GameState *state) {
     if (isInCheck(state, state->turn)) {
         printf("CHECK!\n");
     }
-}
\ No newline at end of file
+}
+
+#ifdef ENGINE_PROFILE
+_Thread_local ProfileEntry profileEntries[PROF_COUNT];
+
+static const char *profileNames[PROF_COUNT] = {
+    "isSquareAttacked", "isInCheck", "isValidMove", "generatePackedMoves", "generateMoves",
+    "isCheckmate", "isStalemate", "isDraw", "makeMove", "doMove", "unmakeMove",
+    "evaluatePosition", "mobilityScore", "staticExchangeEval"
+};
+
+void profileReset(void) {
+    memset(profileEntries, 0, sizeof(profileEntries));
+}
+
+// Add the counters of another thread, e.g. a search helper that has finished
+void profileAdd(const ProfileEntry *entries) {
+    for (int i = 0; i < PROF_COUNT; i++) {
+        profileEntries[i].calls += entries[i].calls;
+        profileEntries[i].ticks += entries[i].ticks;
+    }
+}
+
+// Calls, total and average time of every counter that was hit since the last reset
+void profileDump(FILE *out, const char *title) {
+    fprintf(out, "Profile: %s\n", title);
+    fprintf(out, "%-20s %14s %18s %12s\n", "Function", "Calls", "Total " PROFILE_TICK_UNIT,
+            PROFILE_TICK_UNIT "/call");
+    for (int i = 0; i < PROF_COUNT; i++) {
+        const ProfileEntry *entry = &profileEntries[i];
+        if (entry->calls == 0) {
+            continue;
+        }
+        fprintf(out, "%-20s %14llu %18llu %12.1f\n", profileNames[i], (unsigned long long)entry->calls,
+                (unsigned long long)entry->ticks, (double)entry->ticks / entry->calls);
+    }
+}
+#endif
@@ -15,6 +15,14 @@
 #define QUEEN 5
 #define KING 6
 
+// Piece values (centipawns)
+#define PAWN_VALUE 100
+#define KNIGHT_VALUE 320
+#define BISHOP_VALUE 330
+#define ROOK_VALUE 500
+#define QUEEN_VALUE 900
+#define KING_VALUE 20000
+
 /* Piece representation
  * Bit 0-2: Piece type (0=empty, 1=pawn, 2=knight, 3=bishop, 4=rook, 5=queen, 6=king)
  * Bit 3: Color (0=white, 1=black)
@@ -23,6 +31,24 @@
 typedef uint8_t Piece;
 typedef uint8_t Color;
 
+/* Bitboard representation
+ * One bit per square, bit index = row * 8 + col (a1 = 0, h1 = 7, a8 = 56, h8 = 63).
+ * Kept in sync with the board array by setPiece.
+ */
+typedef uint64_t Bitboard;
+
+#define SQUARE_INDEX(row, col) ((row) * BOARD_SIZE + (col))
+#define SQUARE_ROW(square) ((square) >> 3)
+#define SQUARE_COL(square) ((square) & 7)
+#define SQUARE_BB(square) (1ULL << (square))
+#define FILE_BB(col) (0x0101010101010101ULL << (col))
+#define RANK_BB(row) (0xFFULL << ((row) * BOARD_SIZE))
+#define LIGHT_SQUARES_BB 0x55AA55AA55AA55AAULL // Squares where (row + col) is odd
+#define POP_COUNT(bb) __builtin_popcountll(bb)
+#define LSB_INDEX(bb) __builtin_ctzll(bb)
+#define MSB_INDEX(bb) (63 - __builtin_clzll(bb))
+#define POP_LSB(bb) ((bb) &= (bb) - 1)
+
 typedef struct {
     Piece board[BOARD_SIZE][BOARD_SIZE];
     Color turn;
@@ -31,6 +57,14 @@ typedef struct {
     int halfMoveClock;         // Moves since last capture or pawn advance (for 50-move rule)
     int fullMoveNumber;        // Incremented after Black's move
     int capturedPieces[2][6];  // Count of captured pieces [color][piece_type-1]
+    Bitboard pieceBB[2][7];    // Piece bitboards [color][piece type], index 0 unused
+    Bitboard colorBB[2];       // All pieces of each color
+    Bitboard occupiedBB;       // All pieces on the board
+    int kingSquare[2];         // Square index of each king, -1 if absent
+    int pieceCount[2][7];      // Pieces on the board [color][piece type], index 0 unused
+    int bishopSquareCount[2][2]; // Bishops [color][square color], 0=dark, 1=light
+    int material[2];           // Value of each side's pieces, king excluded (centipawns)
+    uint64_t hashKey;          // Zobrist key: pieces, side to move, castling rights, en passant file
 } GameState;
 
 typedef struct {
@@ -46,6 +80,32 @@ typedef struct {
     int count;
 } MoveList;
 
+/* Packed move representation, used by the search
+ * Bit 0-5: From square (bitboard index)
+ * Bit 6-11: To square (bitboard index)
+ * Bit 12-14: Promotion piece type (0 if not a promotion)
+ */
+typedef uint16_t PackedMove;
+
+#define PACKED_MOVE_NONE 0 // a1a1, never a legal move
+#define PACK_MOVE(from, to, promotion) ((PackedMove)((from) | ((to) << 6) | ((promotion) << 12)))
+#define PACKED_FROM(move) ((move) & 0x3F)
+#define PACKED_TO(move) (((move) >> 6) & 0x3F)
+#define PACKED_PROMOTION(move) (((move) >> 12) & 0x07)
+
+typedef struct {
+    PackedMove moves[256];
+    int scores[256];   // Ordering scores, filled in by the caller
+    int count;
+} ScoredMoveList;
+
+// Which legal moves generateMovesOfType produces
+typedef enum {
+    GEN_ALL,      // Every legal move
+    GEN_CAPTURES, // Tactical moves: captures, en passant and queen promotions
+    GEN_QUIETS    // Everything else, including castling and quiet under-promotions
+} MoveGenType;
+
 typedef struct {
     GameState state;
     Move lastMove;
@@ -56,8 +116,20 @@ typedef struct {
     int oldEnPassantCol;
     int oldHalfMoveClock;
     bool oldCastlingRights[2][2];
+    int oldPgnLength;         // PGN length before this move, restored by undo
 } MoveHistory;
 
+// Minimal undo record for doMove/unmakeMove: only what cannot be recomputed from the move
+typedef struct {
+    PackedMove move;
+    Piece movedPiece;         // Piece as it stood on the from square
+    Piece capturedPiece;      // EMPTY if nothing was captured
+    bool castlingRights[2][2];
+    int enPassantCol;
+    int halfMoveClock;
+    uint64_t hashKey;
+} MoveUndo;
+
 typedef struct {
     MoveHistory history[1024]; // Stack for undo/redo
     int historyCount;
@@ -66,6 +138,14 @@ typedef struct {
     int pgnLength;
 } GameHistory;
 
+// Hash keys of the positions before the current one, oldest first, for repetition checks
+#define MAX_KEY_HISTORY 2048 // A full GameHistory plus the deepest search line
+typedef struct {
+    uint64_t keys[MAX_KEY_HISTORY];
+    int count;
+    int rootCount;            // Keys from the game played before the search root
+} KeyHistory;
+
 // Board and game initialization
 void initializeGame(GameState *state);
 void resetGame(GameState *state, GameHistory *history);
@@ -73,11 +153,18 @@ void resetGame(GameState *state, GameHistory *history);
 // Move generation and validation
 bool isValidMove(const GameState *state, Move move);
 void generateMoves(const GameState *state, MoveList *moves);
+void generateMovesReference(const GameState *state, MoveList *moves);
+void generateMovesOfType(const GameState *state, MoveList *moves, MoveGenType type);
+void generateCaptures(const GameState *state, MoveList *moves);
+void generatePackedMoves(const GameState *state, ScoredMoveList *moves, MoveGenType type);
 bool isInCheck(const GameState *state, Color color);
 bool isCheckmate(const GameState *state);
 bool isStalemate(const GameState *state);
 bool isDraw(const GameState *state);
 bool isThreefoldRepetition(const GameHistory *history);
+bool isRepetition(const KeyHistory *keys, const GameState *state, int times);
+bool isSearchRepetition(const KeyHistory *keys, const GameState *state);
+void collectHistoryKeys(const GameHistory *history, KeyHistory *keys);
 bool isFiftyMoveDraw(const GameState *state);
 bool isInsufficientMaterial(const GameState *state);
 
@@ -85,18 +172,35 @@ bool isInsufficientMaterial(const GameState *state);
 bool makeMove(GameState *state, Move move, GameHistory *history);
 void undoMove(GameState *state, GameHistory *history);
 void redoMove(GameState *state, GameHistory *history);
+void doMove(GameState *state, PackedMove move, MoveUndo *undo);
+void unmakeMove(GameState *state, const MoveUndo *undo);
 
 // Utility functions
 Piece getPiece(const GameState *state, int row, int col);
 void setPiece(GameState *state, int row, int col, Piece piece);
 bool isSquareAttacked(const GameState *state, int row, int col, Color attackingColor);
+Bitboard attackersTo(const GameState *state, int square, Color color, Bitboard occupied);
+void initAttackTables(void);
+void initZobristKeys(void);
+uint64_t computeHashKey(const GameState *state);
+Bitboard knightAttacks(int square);
+Bitboard kingAttacks(int square);
+Bitboard pawnAttacks(Color color, int square);
+Bitboard bishopAttacks(int square, Bitboard occupied);
+Bitboard rookAttacks(int square, Bitboard occupied);
+PackedMove packMove(Move move);
+Move unpackMove(PackedMove move);
 void algebraicToMove(const char *algebraic, Move *move);
 void moveToAlgebraic(const GameState *state, Move move, char *algebraic);
+void moveToLongAlgebraic(Move move, char *text);
+uint64_t monotonicNanoseconds(void);
+double nowSeconds(void);
 void addMoveToPGN(GameState *state, Move move, GameHistory *history);
 
 // Save and load game
 bool saveGame(const GameState *state, const GameHistory *history, const char *filename);
 bool loadGame(GameState *state, GameHistory *history, const char *filename);
+bool loadFEN(GameState *state, const char *fen);
 
 // Piece manipulation
 #define CREATE_PIECE(type, color) ((Piece)((type) | ((color) << 3)))
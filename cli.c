@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chess.h"
+#include "ai.h"
+#include "profile.h"
+
+// Headless engine front end: loads a position, searches it to a fixed depth or for a given
+// time, and prints the best move, score, principal variation and speed of each search.
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+#define DEFAULT_DEPTH 4
+
+static GameHistory history;
+
+// Play a move given in long algebraic notation ("e2e4", "e7e8q") if it is legal
+static bool playMove(GameState *state, const char *text) {
+    MoveList moves;
+    generateMoves(state, &moves);
+    
+    for (int i = 0; i < moves.count; i++) {
+        char candidate[8];
+        moveToLongAlgebraic(moves.moves[i], candidate);
+        if (strcmp(candidate, text) == 0) {
+            return makeMove(state, moves.moves[i], &history);
+        }
+    }
+    
+    return false;
+}
+
+// Play a space separated list of moves
+static bool playMoves(GameState *state, const char *list) {
+    char text[8];
+    int length = 0;
+    
+    for (const char *p = list; ; p++) {
+        if (*p == ' ' || *p == '\0') {
+            if (length > 0) {
+                text[length] = '\0';
+                if (!playMove(state, text)) {
+                    fprintf(stderr, "Illegal move: %s\n", text);
+                    return false;
+                }
+                length = 0;
+            }
+            if (*p == '\0') {
+                break;
+            }
+        } else if (length < (int)sizeof(text) - 1) {
+            text[length++] = *p;
+        }
+    }
+    
+    return true;
+}
+
+// One line per search: depth, score, nodes, speed and the principal variation
+static void printSearchInfo(const SearchStats *stats) {
+    printf("info depth %d score ", stats->depth);
+    if (abs(stats->score) > MATE_SCORE - MAX_SEARCH_PLY) {
+        int plies = MATE_SCORE - abs(stats->score);
+        printf("mate %d", (stats->score > 0) ? (plies + 1) / 2 : -(plies + 1) / 2);
+    } else {
+        printf("cp %d", stats->score);
+    }
+    
+    printf(" nodes %llu nps %.0f time %.0f tthits %.1f%% pv", (unsigned long long)stats->nodes, stats->nps,
+           stats->seconds * 1000, stats->ttProbes ? 100.0 * stats->ttHits / stats->ttProbes : 0.0);
+    for (int i = 0; i < stats->pvLength; i++) {
+        char text[8];
+        moveToLongAlgebraic(unpackMove(stats->pv[i]), text);
+        printf(" %s", text);
+    }
+    printf("\n");
+}
+
+static void usage(const char *program) {
+    printf("Usage: %s [--fen \"FEN\"] [--moves \"e2e4 e7e5 ...\"] [--depth N] [--time MS]\n"
+           "       [--hash MB] [--threads N]\n", program);
+    printf("  --fen FEN   Start from this position instead of the initial one\n");
+    printf("  --moves M   Play these moves (long algebraic) before searching\n");
+    printf("  --depth N   Search depth in plies (default %d)\n", DEFAULT_DEPTH);
+    printf("  --time MS   Search deeper and deeper until the time is used up (instead of --depth)\n");
+    printf("  --hash MB   Transposition table size (default %d)\n", DEFAULT_HASH_MB);
+    printf("  --threads N Search with N threads sharing the table (default 1, at most %d)\n",
+           MAX_SEARCH_THREADS);
+}
+
+int main(int argc, char *argv[]) {
+    const char *fen = START_FEN;
+    const char *moveList = NULL;
+    int depth = 0;
+    int timeLimit = 0;
+    int hashSize = DEFAULT_HASH_MB;
+    
+    // Parse command line arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fen") == 0 && i + 1 < argc) {
+            fen = argv[++i];
+        } else if (strcmp(argv[i], "--moves") == 0 && i + 1 < argc) {
+            moveList = argv[++i];
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            timeLimit = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+            hashSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            setSearchThreads(atoi(argv[++i]));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (depth <= 0) {
+        depth = DEFAULT_DEPTH;
+    }
+    if (depth >= MAX_SEARCH_PLY) {
+        depth = MAX_SEARCH_PLY - 1;
+    }
+    
+    if (!setHashSize(hashSize)) {
+        fprintf(stderr, "Invalid transposition table size or out of memory: %d MB\n", hashSize);
+        return 1;
+    }
+    
+    GameState state;
+    if (!loadFEN(&state, fen)) {
+        fprintf(stderr, "Invalid FEN: %s\n", fen);
+        return 1;
+    }
+    memset(&history, 0, sizeof(history));
+    if (moveList && !playMoves(&state, moveList)) {
+        return 1;
+    }
+    
+    // A timed search deepens by itself and reports its last completed depth
+    Move best;
+    SearchStats stats;
+    
+    PROFILE_RESET();
+    if (timeLimit > 0) {
+        best = getBestMoveTimedWithHistory(&state, timeLimit, &history, &stats);
+    } else {
+        best = getBestMoveWithHistory(&state, (AIDifficulty)depth, &history, &stats);
+    }
+    printSearchInfo(&stats);
+    
+    if (best.fromRow < 0) {
+        printf("bestmove (none)\n");
+    } else {
+        char text[8];
+        moveToLongAlgebraic(best, text);
+        printf("bestmove %s\n", text);
+    }
+    PROFILE_DUMP(stdout, "search");
+    
+    return 0;
+}
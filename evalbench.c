@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chess.h"
+#include "ai.h"
+
+// Evaluation benchmark: times each evaluation term and the whole evaluatePosition() over a
+// corpus of positions, and checks every score against a golden file so that an optimization
+// of the evaluation can be shown not to change it.
+
+#define DEFAULT_CORPUS "eval_corpus.fen"
+#define DEFAULT_GOLDEN "eval_golden.txt"
+#define DEFAULT_ITERATIONS 100
+#define MAX_FEN_LENGTH 256
+
+typedef int (*EvalTerm)(const GameState *state);
+
+typedef struct {
+    const char *name;
+    EvalTerm term;
+} EvalBenchTerm;
+
+// Scored columns of the golden file, in order. The total is from the side to move's point of
+// view, the terms from White's.
+static const EvalBenchTerm evalTerms[] = {
+    {"material", materialScore},
+    {"mobility", mobilityScore},
+    {"pawns", pawnStructureScore},
+    {"king", kingSafetyScore},
+    {"center", centerControlScore},
+    {"total", evaluatePosition},
+};
+
+#define TERM_COUNT ((int)(sizeof(evalTerms) / sizeof(evalTerms[0])))
+
+typedef struct {
+    GameState *states;
+    int count;
+    int capacity;
+} Corpus;
+
+// Load one FEN per line; blank lines and lines starting with '#' are skipped
+static bool loadCorpus(Corpus *corpus, const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot open corpus %s\n", filename);
+        return false;
+    }
+    
+    char line[MAX_FEN_LENGTH];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        
+        if (corpus->count == corpus->capacity) {
+            int capacity = corpus->capacity ? corpus->capacity * 2 : 256;
+            GameState *grown = realloc(corpus->states, capacity * sizeof(GameState));
+            if (!grown) {
+                fclose(file);
+                return false;
+            }
+            corpus->states = grown;
+            corpus->capacity = capacity;
+        }
+        
+        if (!loadFEN(&corpus->states[corpus->count], line)) {
+            fprintf(stderr, "%s:%d: invalid FEN: %s\n", filename, lineNumber, line);
+            fclose(file);
+            return false;
+        }
+        corpus->count++;
+    }
+    
+    fclose(file);
+    return corpus->count > 0;
+}
+
+static bool writeGolden(const Corpus *corpus, const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot write %s\n", filename);
+        return false;
+    }
+    
+    fprintf(file, "#");
+    for (int t = 0; t < TERM_COUNT; t++) {
+        fprintf(file, " %s", evalTerms[t].name);
+    }
+    fprintf(file, "\n");
+    
+    for (int i = 0; i < corpus->count; i++) {
+        for (int t = 0; t < TERM_COUNT; t++) {
+            fprintf(file, (t == 0) ? "%d" : " %d", evalTerms[t].term(&corpus->states[i]));
+        }
+        fprintf(file, "\n");
+    }
+    
+    fclose(file);
+    printf("Wrote %d scores to %s\n", corpus->count, filename);
+    return true;
+}
+
+// Compare every score with the golden file, one line per corpus position
+static bool checkGolden(const Corpus *corpus, const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot open golden file %s (create it with --write-golden)\n", filename);
+        return false;
+    }
+    
+    char line[256];
+    int position = 0;
+    int mismatches = 0;
+    while (fgets(line, sizeof(line), file) && position < corpus->count) {
+        if (line[0] == '#') {
+            continue;
+        }
+        
+        const GameState *state = &corpus->states[position];
+        char *cursor = line;
+        for (int t = 0; t < TERM_COUNT; t++) {
+            char *end;
+            long expected = strtol(cursor, &end, 10);
+            int actual = evalTerms[t].term(state);
+            if (end == cursor || expected != actual) {
+                if (mismatches < 20) {
+                    printf("Position %d: %s is %d, golden %ld\n", position + 1, evalTerms[t].name, actual,
+                           expected);
+                }
+                mismatches++;
+            }
+            cursor = end;
+        }
+        position++;
+    }
+    fclose(file);
+    
+    if (position != corpus->count) {
+        printf("Golden file has %d positions, corpus has %d\n", position, corpus->count);
+        return false;
+    }
+    if (mismatches) {
+        printf("%d scores differ from %s\n", mismatches, filename);
+        return false;
+    }
+    
+    printf("All %d positions match %s\n", corpus->count, filename);
+    return true;
+}
+
+// Average time of one call of the term, over every corpus position
+static double timeTerm(const Corpus *corpus, EvalTerm term, int iterations, long long *sink) {
+    long long sum = 0;
+    double start = nowSeconds();
+    
+    for (int n = 0; n < iterations; n++) {
+        for (int i = 0; i < corpus->count; i++) {
+            sum += term(&corpus->states[i]);
+        }
+    }
+    
+    double seconds = nowSeconds() - start;
+    *sink += sum; // Keeps the calls from being optimized away
+    return seconds * 1e9 / ((double)iterations * corpus->count);
+}
+
+static void usage(const char *program) {
+    printf("Usage: %s [--corpus FILE] [--golden FILE] [--iterations N] [--write-golden]\n", program);
+    printf("  --corpus FILE   Positions to evaluate, one FEN per line (default %s)\n", DEFAULT_CORPUS);
+    printf("  --golden FILE   Expected scores for the corpus (default %s)\n", DEFAULT_GOLDEN);
+    printf("  --iterations N  Passes over the corpus per term (default %d)\n", DEFAULT_ITERATIONS);
+    printf("  --write-golden  Record the current scores as the golden file instead of checking\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *corpusFile = DEFAULT_CORPUS;
+    const char *goldenFile = DEFAULT_GOLDEN;
+    int iterations = DEFAULT_ITERATIONS;
+    bool recordGolden = false;
+    
+    // Parse command line arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            corpusFile = argv[++i];
+        } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            goldenFile = argv[++i];
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+            if (iterations < 1) iterations = 1;
+        } else if (strcmp(argv[i], "--write-golden") == 0) {
+            recordGolden = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    Corpus corpus = {0};
+    if (!loadCorpus(&corpus, corpusFile)) {
+        return 1;
+    }
+    
+    if (recordGolden) {
+        bool written = writeGolden(&corpus, goldenFile);
+        free(corpus.states);
+        return written ? 0 : 1;
+    }
+    
+    bool ok = checkGolden(&corpus, goldenFile);
+    
+    printf("\n%d positions, %d iterations\n", corpus.count, iterations);
+    printf("%-10s %12s\n", "Term", "ns/position");
+    long long sink = 0;
+    for (int t = 0; t < TERM_COUNT; t++) {
+        printf("%-10s %12.1f\n", evalTerms[t].name, timeTerm(&corpus, evalTerms[t].term, iterations, &sink));
+    }
+    printf("(checksum %lld)\n", sink);
+    
+    free(corpus.states);
+    return ok ? 0 : 1;
+}
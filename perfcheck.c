@@ -0,0 +1,267 @@
+#define _POSIX_C_SOURCE 200809L // popen
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Performance regression check: runs the perft, eval and search benchmarks several times,
+// summarizes each measurement by its median and interquartile range, writes the results as JSON
+// and compares them with a baseline. A metric regresses when its median is worse than the
+// baseline's by more than the tolerance and the two interquartile ranges do not overlap. The
+// search node signature must match the baseline exactly.
+
+#define DEFAULT_RUNS 5
+#define DEFAULT_TOLERANCE 3.0 // Percent
+#define DEFAULT_BASELINE "bench_baseline.json"
+#define DEFAULT_OUTPUT "bench_results.json"
+#define MAX_RUNS 50
+
+typedef struct {
+    const char *name;
+    const char *command;
+    const char *prefix;    // Output line holding the value
+    bool higherIsBetter;
+    double samples[MAX_RUNS];
+    double median;
+    double q1;
+    double q3;
+} Metric;
+
+static Metric metrics[] = {
+    {.name = "perft_nps", .command = "./perft --suite --bulk --depth 5", .prefix = "NPS:", .higherIsBetter = true},
+    {.name = "eval_ns", .command = "./evalbench --iterations 50", .prefix = "total", .higherIsBetter = false},
+    {.name = "search_nps", .command = "./bench --quiet", .prefix = "NPS:", .higherIsBetter = true},
+};
+
+#define METRIC_COUNT ((int)(sizeof(metrics) / sizeof(metrics[0])))
+#define SIGNATURE_COMMAND "./bench --quiet"
+
+// Run a benchmark and read the number after the first line starting with prefix.
+// Fails if the benchmark does, e.g. on a perft count or eval score mismatch.
+static bool runBenchmark(const char *command, const char *prefix, double *value) {
+    FILE *pipe = popen(command, "r");
+    if (!pipe) {
+        fprintf(stderr, "Cannot run %s\n", command);
+        return false;
+    }
+    
+    char line[256];
+    bool found = false;
+    size_t prefixLength = strlen(prefix);
+    while (fgets(line, sizeof(line), pipe)) {
+        if (!found && strncmp(line, prefix, prefixLength) == 0) {
+            found = sscanf(line + prefixLength, "%lf", value) == 1;
+        }
+    }
+    
+    int status = pclose(pipe);
+    if (status != 0 || !found) {
+        fprintf(stderr, "%s failed (status %d%s)\n", command, status, found ? "" : ", no result");
+        return false;
+    }
+    return true;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Quantile of sorted values with linear interpolation between neighbours
+static double quantile(const double *sorted, int count, double q) {
+    double position = q * (count - 1);
+    int index = (int)position;
+    if (index + 1 >= count) {
+        return sorted[count - 1];
+    }
+    return sorted[index] + (position - index) * (sorted[index + 1] - sorted[index]);
+}
+
+static void summarize(Metric *metric, int runs) {
+    double sorted[MAX_RUNS];
+    memcpy(sorted, metric->samples, runs * sizeof(double));
+    qsort(sorted, runs, sizeof(double), compareDoubles);
+    
+    metric->median = quantile(sorted, runs, 0.5);
+    metric->q1 = quantile(sorted, runs, 0.25);
+    metric->q3 = quantile(sorted, runs, 0.75);
+}
+
+static bool writeResults(const char *filename, int runs, uint64_t signature) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot write %s\n", filename);
+        return false;
+    }
+    
+    fprintf(file, "{\n  \"runs\": %d,\n  \"signature\": %llu,\n  \"metrics\": {\n", runs,
+            (unsigned long long)signature);
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        const Metric *metric = &metrics[m];
+        fprintf(file, "    \"%s\": {\"median\": %.1f, \"q1\": %.1f, \"q3\": %.1f, \"iqr\": %.1f, \"samples\": [",
+                metric->name, metric->median, metric->q1, metric->q3, metric->q3 - metric->q1);
+        for (int i = 0; i < runs; i++) {
+            fprintf(file, (i == 0) ? "%.1f" : ", %.1f", metric->samples[i]);
+        }
+        fprintf(file, "]}%s\n", (m < METRIC_COUNT - 1) ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+    
+    fclose(file);
+    return true;
+}
+
+// Number following "key": after the given position in a JSON text
+static bool jsonNumber(const char *text, const char *key, double *value) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *found = strstr(text, pattern);
+    return found && sscanf(found + strlen(pattern), "%lf", value) == 1;
+}
+
+static char *readFile(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        return NULL;
+    }
+    
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    char *text = malloc(size + 1);
+    if (text) {
+        size_t length = fread(text, 1, size, file);
+        text[length] = '\0';
+    }
+    fclose(file);
+    return text;
+}
+
+// Compare with the baseline; returns false on a regression or a signature change
+static bool compareBaseline(const char *filename, uint64_t signature, double tolerance) {
+    char *text = readFile(filename);
+    if (!text) {
+        fprintf(stderr, "Cannot read baseline %s (create it with --write-baseline)\n", filename);
+        return false;
+    }
+    
+    bool ok = true;
+    double baselineSignature;
+    if (!jsonNumber(text, "signature", &baselineSignature)) {
+        printf("Baseline has no signature\n");
+        ok = false;
+    } else if ((uint64_t)baselineSignature != signature) {
+        printf("Signature changed: %llu, baseline %llu (search behavior differs)\n",
+               (unsigned long long)signature, (unsigned long long)baselineSignature);
+        ok = false;
+    } else {
+        printf("Signature matches: %llu\n", (unsigned long long)signature);
+    }
+    
+    printf("\n%-12s %14s %14s %9s  %s\n", "Metric", "Baseline", "Current", "Change", "Result");
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        const Metric *metric = &metrics[m];
+        const char *section = strstr(text, metric->name);
+        double median, q1, q3;
+        if (!section || !jsonNumber(section, "median", &median) || !jsonNumber(section, "q1", &q1) ||
+            !jsonNumber(section, "q3", &q3)) {
+            printf("%-12s missing from baseline\n", metric->name);
+            ok = false;
+            continue;
+        }
+        
+        // Positive change is an improvement
+        double change = 100.0 * (metric->median - median) / median;
+        if (!metric->higherIsBetter) {
+            change = -change;
+        }
+        bool separated = metric->higherIsBetter ? (metric->q3 < q1) : (metric->q1 > q3);
+        bool regressed = change < -tolerance && separated;
+        bool improved = change > tolerance && (metric->higherIsBetter ? (metric->q1 > q3) : (metric->q3 < q1));
+        
+        printf("%-12s %14.1f %14.1f %+8.1f%%  %s\n", metric->name, median, metric->median, change,
+               regressed ? "SLOWER" : (improved ? "faster" : "ok"));
+        if (regressed) {
+            ok = false;
+        }
+    }
+    
+    free(text);
+    return ok;
+}
+
+static void usage(const char *program) {
+    printf("Usage: %s [--runs N] [--tolerance PCT] [--baseline FILE] [--output FILE] [--write-baseline]\n",
+           program);
+    printf("  --runs N         Repetitions of each benchmark (default %d)\n", DEFAULT_RUNS);
+    printf("  --tolerance PCT  Slowdown of the median ignored as noise (default %.0f%%)\n", DEFAULT_TOLERANCE);
+    printf("  --baseline FILE  Results to compare with (default %s)\n", DEFAULT_BASELINE);
+    printf("  --output FILE    Where to write the results (default %s)\n", DEFAULT_OUTPUT);
+    printf("  --write-baseline Write the results to the baseline file instead of comparing\n");
+}
+
+int main(int argc, char *argv[]) {
+    int runs = DEFAULT_RUNS;
+    double tolerance = DEFAULT_TOLERANCE;
+    const char *baselineFile = DEFAULT_BASELINE;
+    const char *outputFile = DEFAULT_OUTPUT;
+    bool recordBaseline = false;
+    
+    // Parse command line arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+            if (runs < 1) runs = 1;
+            if (runs > MAX_RUNS) runs = MAX_RUNS;
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselineFile = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (strcmp(argv[i], "--write-baseline") == 0) {
+            recordBaseline = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    // The signature does not depend on timing, so one run is enough
+    double signature;
+    if (!runBenchmark(SIGNATURE_COMMAND, "Signature:", &signature)) {
+        return 1;
+    }
+    
+    // Interleave the benchmarks so a slow phase of the machine affects all of them alike
+    for (int run = 0; run < runs; run++) {
+        printf("Run %d/%d\n", run + 1, runs);
+        fflush(stdout);
+        for (int m = 0; m < METRIC_COUNT; m++) {
+            if (!runBenchmark(metrics[m].command, metrics[m].prefix, &metrics[m].samples[run])) {
+                return 1;
+            }
+        }
+    }
+    
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        summarize(&metrics[m], runs);
+    }
+    
+    const char *resultFile = recordBaseline ? baselineFile : outputFile;
+    if (!writeResults(resultFile, runs, (uint64_t)signature)) {
+        return 1;
+    }
+    printf("Results written to %s\n", resultFile);
+    if (recordBaseline) {
+        return 0;
+    }
+    
+    bool ok = compareBaseline(baselineFile, (uint64_t)signature, tolerance);
+    printf("%s\n", ok ? "No regressions" : "REGRESSION");
+    return ok ? 0 : 1;
+}
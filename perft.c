@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "chess.h"
+
+// Move generator test: counts the leaf nodes of the legal move tree to a fixed depth
+// and compares them with published reference counts.
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+#define MAX_REFERENCE_DEPTH 6
+
+// Reference position with known node counts (0 where no count is listed)
+typedef struct {
+    const char *name;
+    const char *fen;
+    uint64_t nodes[MAX_REFERENCE_DEPTH]; // Indexed by depth - 1
+} PerftPosition;
+
+static const PerftPosition perftSuite[] = {
+    {"Start position", START_FEN,
+     {20, 400, 8902, 197281, 4865609, 119060324}},
+    {"Kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+     {48, 2039, 97862, 4085603, 193690690, 8031647685ULL}},
+    {"Position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+     {14, 191, 2812, 43238, 674624, 11030083}},
+    {"Position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+     {6, 264, 9467, 422333, 15833292, 706045033}},
+    {"Position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+     {44, 1486, 62379, 2103487, 89941194, 0}},
+    {"Position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+     {46, 2079, 89890, 3894594, 164075551, 6923051137ULL}},
+};
+
+#define SUITE_SIZE ((int)(sizeof(perftSuite) / sizeof(perftSuite[0])))
+
+static GameHistory history;
+
+/* Perft transposition table
+ * Caches the node count of a subtree by position key and depth. data packs the count in the
+ * upper 56 bits and the depth in the low 8 bits. Each slot is simply overwritten.
+ * All threads share the table without locks, validating entries by key ^ data like the
+ * search's transposition table (see ai.c).
+ */
+typedef struct {
+    _Atomic uint64_t key;  // Position key ^ data
+    _Atomic uint64_t data;
+} PerftEntry;
+
+typedef struct {
+    PerftEntry *entries;  // NULL when hashing is off
+    uint64_t mask;        // Entry count - 1 (a power of two)
+} PerftTable;
+
+// Hash table counters, kept per thread
+typedef struct {
+    uint64_t probes;
+    uint64_t hits;
+} PerftStats;
+
+static PerftTable table;
+static PerftStats mainStats;
+static bool bulkCounting = false; // Count last-ply moves without making them
+static int threadCount = 1;
+
+/* Parallel perft
+ * The tree is expanded a few plies on the main thread; every position at the split ply becomes a
+ * task with its own copy of the state. Worker threads take tasks from a shared counter until none
+ * are left. Each task's count is stored in its slot and summed in order, so the total does not
+ * depend on scheduling.
+ */
+#define SPLIT_PLIES 2
+#define MAX_THREADS 256
+
+typedef struct {
+    GameState state;
+    int depth;        // Depth still to count below this position
+    int rootMove;     // Index of the root move it descends from
+    uint64_t nodes;
+} PerftTask;
+
+typedef struct {
+    pthread_t thread;
+    int tasks;        // Tasks completed by this thread
+    uint64_t nodes;
+    double seconds;   // Time spent counting
+    PerftStats stats;
+} PerftWorker;
+
+static PerftTask *tasks;
+static int taskCount;
+static int taskCapacity;
+static atomic_int nextTask;
+static PerftWorker workers[MAX_THREADS];
+
+// Count the leaf nodes below the current position, making and undoing every move
+static uint64_t perft(GameState *state, int depth) {
+    if (depth == 0) {
+        return 1;
+    }
+    
+    MoveList moves;
+    generateMoves(state, &moves);
+    
+    uint64_t nodes = 0;
+    for (int i = 0; i < moves.count; i++) {
+        if (!makeMove(state, moves.moves[i], &history)) {
+            continue; // Rejected by validation: the count will show the mismatch
+        }
+        nodes += perft(state, depth - 1);
+        undoMove(state, &history);
+    }
+    
+    return nodes;
+}
+
+// Allocate the largest power-of-two table that fits in the given number of megabytes
+static bool initPerftTable(int megabytes) {
+    uint64_t count = 1;
+    while (count * 2 * sizeof(PerftEntry) <= (uint64_t)megabytes * 1024 * 1024) {
+        count *= 2;
+    }
+    
+    table.entries = calloc(count, sizeof(PerftEntry));
+    table.mask = count - 1;
+    return table.entries != NULL;
+}
+
+// Fast perft: doMove/unmakeMove, leaf moves counted in bulk, and subtree counts cached
+static uint64_t perftBulk(GameState *state, int depth, PerftStats *stats) {
+    if (depth == 0) {
+        return 1;
+    }
+    
+    PerftEntry *entry = NULL;
+    if (table.entries && depth > 1) {
+        entry = &table.entries[state->hashKey & table.mask];
+        uint64_t key = atomic_load_explicit(&entry->key, memory_order_relaxed);
+        uint64_t data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+        stats->probes++;
+        if ((key ^ data) == state->hashKey && (int)(data & 0xFF) == depth) {
+            stats->hits++;
+            return data >> 8;
+        }
+    }
+    
+    ScoredMoveList moves;
+    generatePackedMoves(state, &moves, GEN_ALL);
+    
+    // Every legal move at the last ply is exactly one leaf
+    if (depth == 1) {
+        return moves.count;
+    }
+    
+    uint64_t nodes = 0;
+    for (int i = 0; i < moves.count; i++) {
+        MoveUndo undo;
+        doMove(state, moves.moves[i], &undo);
+        nodes += perftBulk(state, depth - 1, stats);
+        unmakeMove(state, &undo);
+    }
+    
+    if (entry) {
+        uint64_t data = (nodes << 8) | (uint64_t)depth;
+        atomic_store_explicit(&entry->key, state->hashKey ^ data, memory_order_relaxed);
+        atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+    }
+    
+    return nodes;
+}
+
+// Queue the positions at the split ply below the current one as tasks
+static bool collectTasks(GameState *state, int depth, int plies, int rootMove) {
+    if (plies == 0) {
+        if (taskCount == taskCapacity) {
+            int capacity = taskCapacity ? taskCapacity * 2 : 1024;
+            PerftTask *grown = realloc(tasks, capacity * sizeof(PerftTask));
+            if (!grown) {
+                return false;
+            }
+            tasks = grown;
+            taskCapacity = capacity;
+        }
+        
+        PerftTask *task = &tasks[taskCount++];
+        task->state = *state;
+        task->depth = depth;
+        task->rootMove = rootMove;
+        task->nodes = 0;
+        return true;
+    }
+    
+    ScoredMoveList moves;
+    generatePackedMoves(state, &moves, GEN_ALL);
+    
+    for (int i = 0; i < moves.count; i++) {
+        MoveUndo undo;
+        doMove(state, moves.moves[i], &undo);
+        bool ok = collectTasks(state, depth - 1, plies - 1, (rootMove < 0) ? i : rootMove);
+        unmakeMove(state, &undo);
+        if (!ok) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// Worker thread: count tasks until the queue is empty
+static void *perftWorker(void *arg) {
+    PerftWorker *worker = arg;
+    double start = nowSeconds();
+    int index;
+    
+    while ((index = atomic_fetch_add(&nextTask, 1)) < taskCount) {
+        PerftTask *task = &tasks[index];
+        task->nodes = perftBulk(&task->state, task->depth, &worker->stats);
+        worker->nodes += task->nodes;
+        worker->tasks++;
+    }
+    
+    worker->seconds += nowSeconds() - start;
+    return NULL;
+}
+
+// Perft split across the worker threads. rootCounts, if given, receives the count per root move.
+static uint64_t parallelPerft(GameState *state, int depth, uint64_t *rootCounts) {
+    int plies = (depth - 1 < SPLIT_PLIES) ? depth - 1 : SPLIT_PLIES;
+    
+    taskCount = 0;
+    if (!collectTasks(state, depth, plies, -1)) {
+        fprintf(stderr, "Out of memory for perft tasks\n");
+        exit(1);
+    }
+    atomic_store(&nextTask, 0);
+    
+    int started = 0;
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&workers[i].thread, NULL, perftWorker, &workers[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        perftWorker(&workers[0]); // No threads available: count on this one
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    
+    uint64_t nodes = 0;
+    for (int i = 0; i < taskCount; i++) {
+        nodes += tasks[i].nodes;
+        if (rootCounts) {
+            rootCounts[(plies == 0) ? 0 : tasks[i].rootMove] += tasks[i].nodes;
+        }
+    }
+    
+    return nodes;
+}
+
+// Node count below the current position with the selected method
+static uint64_t countNodes(GameState *state, int depth) {
+    if (threadCount > 1 && depth > 0) {
+        return parallelPerft(state, depth, NULL);
+    }
+    return bulkCounting ? perftBulk(state, depth, &mainStats) : perft(state, depth);
+}
+
+// Perft with the node count below each root move printed separately
+static uint64_t divide(GameState *state, int depth) {
+    MoveList moves;
+    generateMoves(state, &moves);
+    
+    // With threads the whole tree is split at once and the counts are regrouped by root move
+    uint64_t rootCounts[256] = {0};
+    if (threadCount > 1 && depth > 1) {
+        parallelPerft(state, depth, rootCounts);
+    }
+    
+    uint64_t nodes = 0;
+    for (int i = 0; i < moves.count; i++) {
+        char text[8];
+        moveToLongAlgebraic(moves.moves[i], text);
+        
+        uint64_t count = rootCounts[i];
+        if (threadCount == 1 || depth == 1) {
+            if (makeMove(state, moves.moves[i], &history)) {
+                count = countNodes(state, depth - 1);
+                undoMove(state, &history);
+            }
+        }
+        
+        printf("%s: %llu\n", text, (unsigned long long)count);
+        nodes += count;
+    }
+    
+    printf("\nMoves: %d\n", moves.count);
+    return nodes;
+}
+
+static void printResult(uint64_t nodes, double seconds) {
+    printf("Nodes: %llu\n", (unsigned long long)nodes);
+    printf("Time: %.3f s\n", seconds);
+    printf("NPS: %.0f\n", seconds > 0 ? nodes / seconds : 0.0);
+    
+    PerftStats total = mainStats;
+    for (int i = 0; i < threadCount; i++) {
+        total.probes += workers[i].stats.probes;
+        total.hits += workers[i].stats.hits;
+    }
+    if (table.entries) {
+        printf("Hash probes: %llu, hits: %llu (%.1f%%)\n", (unsigned long long)total.probes,
+               (unsigned long long)total.hits, total.probes ? 100.0 * total.hits / total.probes : 0.0);
+    }
+    
+    if (threadCount > 1) {
+        printf("\nThread  Tasks        Nodes     Time          NPS   Hash hits\n");
+        for (int i = 0; i < threadCount; i++) {
+            const PerftWorker *worker = &workers[i];
+            printf("%6d %6d %12llu %8.3f s %12.0f %11llu\n", i, worker->tasks,
+                   (unsigned long long)worker->nodes, worker->seconds,
+                   worker->seconds > 0 ? worker->nodes / worker->seconds : 0.0,
+                   (unsigned long long)worker->stats.hits);
+        }
+    }
+}
+
+// Run every reference position to the given depth (capped at its deepest known count)
+static bool runSuite(int depth) {
+    uint64_t totalNodes = 0;
+    double totalSeconds = 0;
+    int failures = 0;
+    
+    for (int i = 0; i < SUITE_SIZE; i++) {
+        const PerftPosition *position = &perftSuite[i];
+        int d = depth;
+        while (d > 1 && position->nodes[d - 1] == 0) {
+            d--;
+        }
+        
+        GameState state;
+        loadFEN(&state, position->fen);
+        memset(&history, 0, sizeof(history));
+        
+        double start = nowSeconds();
+        uint64_t nodes = countNodes(&state, d);
+        double seconds = nowSeconds() - start;
+        bool ok = nodes == position->nodes[d - 1];
+        
+        printf("%-16s depth %d  %12llu  %s  %8.3f s  %12.0f nps\n", position->name, d,
+               (unsigned long long)nodes, ok ? "OK  " : "FAIL", seconds, seconds > 0 ? nodes / seconds : 0.0);
+        if (!ok) {
+            printf("  expected %llu\n", (unsigned long long)position->nodes[d - 1]);
+            failures++;
+        }
+        
+        totalNodes += nodes;
+        totalSeconds += seconds;
+    }
+    
+    printf("\n");
+    printResult(totalNodes, totalSeconds);
+    printf("%s\n", failures ? "FAILED" : "All positions match");
+    return failures == 0;
+}
+
+static void usage(const char *program) {
+    printf("Usage: %s [--depth N] [--fen \"FEN\"] [--divide] [--suite] [--bulk] [--hash MB] [--threads N]\n",
+           program);
+    printf("  --depth N   Search depth in plies (default 5, suite default 4)\n");
+    printf("  --fen FEN   Start from this position instead of the initial one\n");
+    printf("  --divide    Print the node count below each root move\n");
+    printf("  --suite     Run the reference positions and check their node counts\n");
+    printf("  --bulk      Count last-ply moves without making them (search make/unmake)\n");
+    printf("  --hash MB   Cache subtree counts in a hash table of this size (implies --bulk)\n");
+    printf("  --threads N Split the tree across N worker threads (implies --bulk)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int depth = -1;
+    const char *fen = START_FEN;
+    bool showDivide = false;
+    bool suite = false;
+    int hashMegabytes = 0;
+    
+    // Parse command line arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fen") == 0 && i + 1 < argc) {
+            fen = argv[++i];
+        } else if (strcmp(argv[i], "--divide") == 0) {
+            showDivide = true;
+        } else if (strcmp(argv[i], "--suite") == 0) {
+            suite = true;
+        } else if (strcmp(argv[i], "--bulk") == 0) {
+            bulkCounting = true;
+        } else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+            hashMegabytes = atoi(argv[++i]);
+            bulkCounting = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threadCount = atoi(argv[++i]);
+            if (threadCount < 1) threadCount = 1;
+            if (threadCount > MAX_THREADS) threadCount = MAX_THREADS;
+            bulkCounting = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (hashMegabytes > 0 && !initPerftTable(hashMegabytes)) {
+        fprintf(stderr, "Could not allocate a %d MB hash table\n", hashMegabytes);
+        return 1;
+    }
+    
+    if (suite) {
+        if (depth < 1 || depth > MAX_REFERENCE_DEPTH) {
+            depth = (depth < 1) ? 4 : MAX_REFERENCE_DEPTH;
+        }
+        return runSuite(depth) ? 0 : 1;
+    }
+    
+    if (depth < 1) {
+        depth = 5;
+    }
+    
+    GameState state;
+    if (!loadFEN(&state, fen)) {
+        fprintf(stderr, "Invalid FEN: %s\n", fen);
+        return 1;
+    }
+    memset(&history, 0, sizeof(history));
+    
+    double start = nowSeconds();
+    uint64_t nodes = showDivide ? divide(&state, depth) : countNodes(&state, depth);
+    double seconds = nowSeconds() - start;
+    
+    printf("\n");
+    printResult(nodes, seconds);
+    return 0;
+}
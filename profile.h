@@ -0,0 +1,85 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Engine profiling
+ * With -DENGINE_PROFILE (make PROFILE=1) the hot functions of chess.c and ai.c count their
+ * calls and the time spent in them: PROFILE_SCOPE at the top of a function starts a timer that
+ * stops when the function returns, however it returns. Times are inclusive, so a function
+ * called by another is counted in both. The counters are per thread; the search adds those of
+ * its helper threads to the main thread's when they finish, so a dump covers all of them and
+ * times are summed over threads. Without the flag every macro compiles to nothing.
+ */
+
+typedef enum {
+    PROF_IS_SQUARE_ATTACKED,
+    PROF_IS_IN_CHECK,
+    PROF_IS_VALID_MOVE,
+    PROF_GENERATE_PACKED_MOVES,
+    PROF_GENERATE_MOVES,
+    PROF_IS_CHECKMATE,
+    PROF_IS_STALEMATE,
+    PROF_IS_DRAW,
+    PROF_MAKE_MOVE,
+    PROF_DO_MOVE,
+    PROF_UNMAKE_MOVE,
+    PROF_EVALUATE_POSITION,
+    PROF_MOBILITY_SCORE,
+    PROF_STATIC_EXCHANGE_EVAL,
+    PROF_COUNT
+} ProfileCounter;
+
+#ifdef ENGINE_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_TICK_UNIT "cycles"
+static inline uint64_t profileTicks(void) {
+    return __rdtsc();
+}
+#else
+#define PROFILE_TICK_UNIT "ns"
+uint64_t monotonicNanoseconds(void); // chess.c, the clock behind nowSeconds()
+static inline uint64_t profileTicks(void) {
+    return monotonicNanoseconds();
+}
+#endif
+
+typedef struct {
+    uint64_t calls;
+    uint64_t ticks;
+} ProfileEntry;
+
+typedef struct {
+    ProfileCounter counter;
+    uint64_t start;
+} ProfileScope;
+
+extern _Thread_local ProfileEntry profileEntries[PROF_COUNT];
+
+static inline void profileScopeEnd(ProfileScope *scope) {
+    ProfileEntry *entry = &profileEntries[scope->counter];
+    entry->calls++;
+    entry->ticks += profileTicks() - scope->start;
+}
+
+void profileReset(void);
+void profileAdd(const ProfileEntry *entries);
+void profileDump(FILE *out, const char *title);
+
+#define PROFILE_SCOPE(counter) \
+    ProfileScope profileScope __attribute__((cleanup(profileScopeEnd))) = {(counter), profileTicks()}
+#define PROFILE_RESET() profileReset()
+#define PROFILE_DUMP(out, title) profileDump((out), (title))
+
+#else
+
+#define PROFILE_SCOPE(counter) ((void)0)
+#define PROFILE_RESET() ((void)0)
+#define PROFILE_DUMP(out, title) ((void)0)
+
+#endif /* ENGINE_PROFILE */
+
+#endif /* PROFILE_H */
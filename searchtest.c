@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chess.h"
+#include "ai.h"
+
+// Search tests: checks of search behavior that a node count alone does not pin down. Prints
+// one line per check and exits with an error if any fails.
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+static int failures;
+
+static void check(bool passed, const char *name) {
+    printf("%-60s %s\n", name, passed ? "ok" : "FAILED");
+    if (!passed) {
+        failures++;
+    }
+}
+
+// Play a space separated list of moves in long algebraic notation
+static bool playMoves(GameState *state, GameHistory *history, const char *list) {
+    char text[8];
+    const char *p = list;
+    
+    while (sscanf(p, "%7s", text) == 1) {
+        MoveList moves;
+        generateMoves(state, &moves);
+        
+        bool played = false;
+        for (int i = 0; i < moves.count && !played; i++) {
+            char candidate[8];
+            moveToLongAlgebraic(moves.moves[i], candidate);
+            if (strcmp(candidate, text) == 0) {
+                played = makeMove(state, moves.moves[i], history);
+            }
+        }
+        if (!played) {
+            fprintf(stderr, "Illegal move: %s\n", text);
+            return false;
+        }
+        
+        p = strstr(p, text) + strlen(text);
+    }
+    
+    return true;
+}
+
+// Start position, then the given moves
+static bool setUp(GameState *state, GameHistory *history, const char *moves) {
+    memset(history, 0, sizeof(*history));
+    return loadFEN(state, START_FEN) && playMoves(state, history, moves);
+}
+
+// Play a move on the search side, recording the key it leaves like the search does
+static void searchMove(GameState *state, KeyHistory *keys, const char *text) {
+    MoveList moves;
+    generateMoves(state, &moves);
+    
+    for (int i = 0; i < moves.count; i++) {
+        char candidate[8];
+        moveToLongAlgebraic(moves.moves[i], candidate);
+        if (strcmp(candidate, text) == 0) {
+            MoveUndo undo;
+            keys->keys[keys->count++] = state->hashKey;
+            doMove(state, packMove(moves.moves[i]), &undo);
+            return;
+        }
+    }
+}
+
+static void testRepetitionDraws(void) {
+    static GameHistory history;
+    static KeyHistory keys;
+    GameState state;
+    
+    // The knights go out and back once: the start position has occurred once before
+    if (!setUp(&state, &history, "g1f3 g8f6 f3g1 f6g8")) {
+        check(false, "set up repetition game");
+        return;
+    }
+    collectHistoryKeys(&history, &keys);
+    check(!isSearchRepetition(&keys, &state), "position seen once in the game is not a draw");
+    
+    // Repeating it within the search is
+    GameState line = state;
+    KeyHistory lineKeys = keys;
+    searchMove(&line, &lineKeys, "g1f3");
+    searchMove(&line, &lineKeys, "g8f6");
+    searchMove(&line, &lineKeys, "f3g1");
+    searchMove(&line, &lineKeys, "f6g8");
+    check(line.hashKey == state.hashKey && isSearchRepetition(&lineKeys, &line),
+          "position repeated within the search is a draw");
+    
+    // Twice before in the game is a threefold repetition
+    if (!setUp(&state, &history, "g1f3 g8f6 f3g1 f6g8 g1f3 g8f6 f3g1 f6g8")) {
+        check(false, "set up threefold game");
+        return;
+    }
+    collectHistoryKeys(&history, &keys);
+    check(isSearchRepetition(&keys, &state), "position seen twice in the game is a draw");
+}
+
+// Every position of the game occurs once, so the game adds no draws: the search must visit
+// the same tree and find the same score as from the position alone
+static void testSearchIgnoresSingleGameOccurrence(void) {
+    static GameHistory history;
+    GameState state;
+    
+    if (!setUp(&state, &history, "g1f3 g8f6 f3g1 f6g8")) {
+        check(false, "set up search game");
+        return;
+    }
+    
+    SearchStats withGame;
+    SearchStats withoutGame;
+    clearHash();
+    srand(1);
+    getBestMoveWithHistory(&state, (AIDifficulty)4, &history, &withGame);
+    clearHash();
+    srand(1);
+    getBestMoveWithHistory(&state, (AIDifficulty)4, NULL, &withoutGame);
+    
+    check(withGame.nodes == withoutGame.nodes && withGame.score == withoutGame.score,
+          "search is not changed by positions seen once in the game");
+}
+
+int main(void) {
+    testRepetitionDraws();
+    testSearchIgnoresSingleGameOccurrence();
+    
+    printf("%s\n", failures ? "FAILED" : "All tests passed");
+    return failures ? 1 : 0;
+}
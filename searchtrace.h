@@ -0,0 +1,37 @@
+#ifndef SEARCHTRACE_H
+#define SEARCHTRACE_H
+
+#include <stdint.h>
+
+/* Search trace file format
+ * Written by ai.c when it is compiled with -DSEARCH_TRACE, read by traceread. The file starts
+ * with the 4 byte magic "CSTR" and a 32-bit version, followed by fixed-size events in the order
+ * they happen (native byte order). Nodes nest: each NODE or QNODE event is closed by the EXIT
+ * event carrying its score, and the events in between belong to its subtree.
+ */
+#define TRACE_MAGIC "CSTR"
+#define TRACE_VERSION 1
+
+// Default trace file, relative to the working directory
+#ifndef SEARCH_TRACE_FILE
+#define SEARCH_TRACE_FILE "search.trace"
+#endif
+
+typedef enum {
+    TRACE_SEARCH = 1, // A search starts; depth is its depth
+    TRACE_NODE,       // Main search node entered: depth, alpha (a) and beta (b)
+    TRACE_QNODE,      // Quiescence node entered: alpha (a) and beta (b)
+    TRACE_MOVE,       // The current node searches move next
+    TRACE_CUTOFF,     // move caused a beta cutoff at the current node
+    TRACE_EXIT        // The current node returns a, from its side to move's point of view
+} TraceEventType;
+
+typedef struct {
+    uint8_t type;     // TraceEventType
+    int8_t depth;
+    uint16_t move;    // PackedMove
+    int16_t a;
+    int16_t b;
+} TraceEvent;
+
+#endif /* SEARCHTRACE_H */
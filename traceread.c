@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "chess.h"
+#include "searchtrace.h"
+
+// Search trace reader: rebuilds the trees recorded by a SEARCH_TRACE build of the engine and
+// reports, for each search, its score and principal variation, the subtree size of every root
+// move, and node and cutoff counts per ply. --summary writes the root moves as CSV.
+
+#define MAX_TRACE_DEPTH 256
+
+// A node on the path from the root to the event being read
+typedef struct {
+    PackedMove move;        // Move leading to this node (PACKED_MOVE_NONE at the root)
+    bool sameSide;          // Entered without a move (minimax handing over to quiescence)
+    bool quiescence;
+    int ply;                // Moves from the root
+    int depth;
+    int alpha;              // Search window the node was entered with
+    int beta;
+    uint64_t nodes;         // Subtree size so far, this node included
+    PackedMove nextMove;    // Move announced for the next child
+    int movesSearched;
+    int bestValue;          // Best child score from this node's point of view
+    PackedMove pv[MAX_TRACE_DEPTH];
+    int pvLength;
+} TraceNode;
+
+typedef struct {
+    PackedMove move;
+    int score;
+    const char *bound;      // "=" for an exact score, "<=" or ">=" for a bound
+    uint64_t nodes;
+} RootMove;
+
+typedef struct {
+    uint64_t nodes;
+    uint64_t qnodes;
+    uint64_t cutoffs;
+    uint64_t firstMoveCutoffs;
+} PlyStats;
+
+static TraceNode stack[MAX_TRACE_DEPTH];
+static int stackSize;
+static RootMove rootMoves[256];
+static int rootMoveCount;
+static PlyStats plyStats[MAX_TRACE_DEPTH];
+static int maxPly;
+
+static int searchNumber;
+static int searchDepth;
+static FILE *summaryFile;
+
+static void moveText(PackedMove move, char *text) {
+    moveToLongAlgebraic(unpackMove(move), text);
+}
+
+static void startSearch(int depth) {
+    searchNumber++;
+    searchDepth = depth;
+    stackSize = 0;
+    rootMoveCount = 0;
+    maxPly = 0;
+    memset(plyStats, 0, sizeof(plyStats));
+}
+
+static int compareRootMoves(const void *a, const void *b) {
+    const RootMove *x = a;
+    const RootMove *y = b;
+    return (y->nodes > x->nodes) - (y->nodes < x->nodes);
+}
+
+static void reportSearch(const TraceNode *root, int score) {
+    char text[8];
+    
+    printf("Search %d: depth %d, score %d, %llu nodes\n", searchNumber, searchDepth, score,
+           (unsigned long long)root->nodes);
+    printf("PV:");
+    for (int i = 0; i < root->pvLength; i++) {
+        moveText(root->pv[i], text);
+        printf(" %s", text);
+    }
+    printf("\n");
+    
+    // Root moves, largest subtree first
+    qsort(rootMoves, rootMoveCount, sizeof(RootMove), compareRootMoves);
+    printf("\n%-6s %9s %12s %7s\n", "Move", "Score", "Nodes", "Share");
+    for (int i = 0; i < rootMoveCount; i++) {
+        const RootMove *rootMove = &rootMoves[i];
+        moveText(rootMove->move, text);
+        printf("%-6s %2s %6d %12llu %6.1f%%\n", text, rootMove->bound, rootMove->score,
+               (unsigned long long)rootMove->nodes, 100.0 * rootMove->nodes / root->nodes);
+        if (summaryFile) {
+            fprintf(summaryFile, "%d,%d,%s,%s,%d,%llu\n", searchNumber, searchDepth, text, rootMove->bound,
+                    rootMove->score, (unsigned long long)rootMove->nodes);
+        }
+    }
+    
+    printf("\n%3s %12s %12s %10s %10s\n", "Ply", "Nodes", "QNodes", "Cutoffs", "First move");
+    for (int ply = 0; ply <= maxPly; ply++) {
+        const PlyStats *ps = &plyStats[ply];
+        printf("%3d %12llu %12llu %10llu %9.1f%%\n", ply, (unsigned long long)ps->nodes,
+               (unsigned long long)ps->qnodes, (unsigned long long)ps->cutoffs,
+               ps->cutoffs ? 100.0 * ps->firstMoveCutoffs / ps->cutoffs : 0.0);
+    }
+    printf("\n");
+}
+
+static bool enterNode(const TraceEvent *event) {
+    if (stackSize == MAX_TRACE_DEPTH) {
+        fprintf(stderr, "Trace nests deeper than %d nodes\n", MAX_TRACE_DEPTH);
+        return false;
+    }
+    
+    TraceNode *node = &stack[stackSize];
+    TraceNode *parent = (stackSize > 0) ? &stack[stackSize - 1] : NULL;
+    node->move = parent ? parent->nextMove : PACKED_MOVE_NONE;
+    node->sameSide = parent && parent->nextMove == PACKED_MOVE_NONE;
+    node->quiescence = event->type == TRACE_QNODE;
+    node->ply = parent ? parent->ply + (node->sameSide ? 0 : 1) : 0;
+    node->depth = event->depth;
+    node->alpha = event->a;
+    node->beta = event->b;
+    node->nodes = 1;
+    node->nextMove = PACKED_MOVE_NONE;
+    node->movesSearched = 0;
+    node->bestValue = INT_MIN;
+    node->pvLength = 0;
+    if (parent) {
+        parent->nextMove = PACKED_MOVE_NONE;
+    }
+    
+    int ply = node->ply;
+    if (ply > maxPly) {
+        maxPly = ply;
+    }
+    if (node->quiescence) {
+        plyStats[ply].qnodes++;
+    } else {
+        plyStats[ply].nodes++;
+    }
+    
+    stackSize++;
+    return true;
+}
+
+static void exitNode(int score) {
+    TraceNode *node = &stack[--stackSize];
+    
+    if (stackSize == 0) {
+        reportSearch(node, score);
+        return;
+    }
+    
+    TraceNode *parent = &stack[stackSize - 1];
+    parent->nodes += node->nodes;
+    
+    // Negamax: a child's score is negated for its parent, unless no move separates them
+    int value = node->sameSide ? score : -score;
+    if (value > parent->bestValue) {
+        parent->bestValue = value;
+        int offset = 0;
+        if (node->move != PACKED_MOVE_NONE) {
+            parent->pv[0] = node->move;
+            offset = 1;
+        }
+        int length = node->pvLength;
+        if (length > MAX_TRACE_DEPTH - offset) {
+            length = MAX_TRACE_DEPTH - offset;
+        }
+        memcpy(&parent->pv[offset], node->pv, length * sizeof(PackedMove));
+        parent->pvLength = offset + length;
+    }
+    
+    if (stackSize == 1 && rootMoveCount < 256) {
+        rootMoves[rootMoveCount].move = node->move;
+        rootMoves[rootMoveCount].score = value;
+        // Fail-hard: a child returning its beta is only an upper bound for the root, and one
+        // returning its alpha a lower bound
+        rootMoves[rootMoveCount].bound = (score >= node->beta) ? "<=" : (score <= node->alpha) ? ">=" : "=";
+        rootMoves[rootMoveCount].nodes = node->nodes;
+        rootMoveCount++;
+    }
+}
+
+static bool readTrace(FILE *file) {
+    char magic[4];
+    uint32_t version;
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, TRACE_MAGIC, 4) != 0 ||
+        fread(&version, sizeof(version), 1, file) != 1) {
+        fprintf(stderr, "Not a search trace\n");
+        return false;
+    }
+    if (version != TRACE_VERSION) {
+        fprintf(stderr, "Trace version %u, expected %d\n", version, TRACE_VERSION);
+        return false;
+    }
+    
+    TraceEvent event;
+    while (fread(&event, sizeof(event), 1, file) == 1) {
+        switch (event.type) {
+            case TRACE_SEARCH:
+                startSearch(event.depth);
+                break;
+            
+            case TRACE_NODE:
+            case TRACE_QNODE:
+                if (!enterNode(&event)) {
+                    return false;
+                }
+                break;
+            
+            case TRACE_MOVE:
+                if (stackSize > 0) {
+                    stack[stackSize - 1].nextMove = event.move;
+                    stack[stackSize - 1].movesSearched++;
+                }
+                break;
+            
+            case TRACE_CUTOFF:
+                if (stackSize > 0) {
+                    PlyStats *ps = &plyStats[stack[stackSize - 1].ply];
+                    ps->cutoffs++;
+                    if (stack[stackSize - 1].movesSearched == 1) {
+                        ps->firstMoveCutoffs++;
+                    }
+                }
+                break;
+            
+            case TRACE_EXIT:
+                if (stackSize == 0) {
+                    fprintf(stderr, "Unbalanced trace: exit without a node\n");
+                    return false;
+                }
+                exitNode(event.a);
+                break;
+            
+            default:
+                fprintf(stderr, "Unknown trace event %d\n", event.type);
+                return false;
+        }
+    }
+    
+    if (stackSize > 0) {
+        printf("Trace ends inside search %d (%d open nodes)\n", searchNumber, stackSize);
+    }
+    return true;
+}
+
+static void usage(const char *program) {
+    printf("Usage: %s [--summary FILE] [TRACE]\n", program);
+    printf("  TRACE          Trace written by a SEARCH_TRACE build (default %s)\n", SEARCH_TRACE_FILE);
+    printf("  --summary FILE Write every root move as CSV: search,depth,move,bound,score,nodes\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *traceName = SEARCH_TRACE_FILE;
+    const char *summaryName = NULL;
+    
+    // Parse command line arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--summary") == 0 && i + 1 < argc) {
+            summaryName = argv[++i];
+        } else if (argv[i][0] != '-') {
+            traceName = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    FILE *file = fopen(traceName, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", traceName);
+        return 1;
+    }
+    
+    if (summaryName) {
+        summaryFile = fopen(summaryName, "w");
+        if (!summaryFile) {
+            fprintf(stderr, "Cannot write %s\n", summaryName);
+            fclose(file);
+            return 1;
+        }
+        fprintf(summaryFile, "search,depth,move,bound,score,nodes\n");
+    }
+    
+    bool ok = readTrace(file);
+    fclose(file);
+    if (summaryFile) {
+        fclose(summaryFile);
+    }
+    return ok ? 0 : 1;
+}
@@ -7,6 +7,7 @@
 #include <SDL2/SDL_ttf.h>
 #include <SDL2/SDL_image.h>
 #include "ui.h"
+#include "profile.h"
 
 // Piece textures
 SDL_Texture *pieceTextures[2][7]; // [color][piece type]
@@ -682,7 +683,9 @@ void makeAIMove(UIContext *ui) {
     if (ui->animating) return;
     
     // Get AI move
-    Move aiMove = getBestMove(ui->gameState, ui->aiDifficulty);
+    PROFILE_RESET();
+    Move aiMove = getBestMoveWithHistory(ui->gameState, ui->aiDifficulty, ui->gameHistory, &ui->aiStats);
+    PROFILE_DUMP(stdout, "AI move");
     
     // Invalid move check (no legal moves)
     if (aiMove.fromRow < 0) return;
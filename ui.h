@@ -65,6 +65,7 @@ typedef struct {
     GameHistory *gameHistory;
     GameMode gameMode;
     AIDifficulty aiDifficulty;
+    SearchStats aiStats;
     UITheme theme;
     bool flipBoard;
 